@@ -0,0 +1,96 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "src/nyasRT.hpp"
+using namespace nyasRT::basic_types;
+using nyasRT::Mesh;
+using nyasRT::MeshPtr;
+using nyasRT::Ray;
+using nyasRT::TraceRecord;
+using nyasRT::TriangleTest;
+
+
+// compare the ray-triangle intersection tests of meshes, by the speed of tracing random rays & the rays leaked through edges.
+// usage: benchmark [path to obj file], the default mesh is a closed sphere. the meshes with duplicated vertices, e.g. the seams of
+// texture coordinates, may be leaked through the cracks anyway
+i32 main(i32 argc, char * * argv)
+{
+    constexpr u32 n_rays = 1 << 18;
+    constexpr char const* test_names[] = {"projection", "moller-trumbore", "watertight"};
+
+    auto load_mesh = [&] () -> MeshPtr
+    {
+        return (argc > 1) ? Mesh::load_obj(argv[1]) : Mesh::uv_sphere(900, 300);
+    };
+
+    // random rays through the bounding box of mesh
+    std::vector<Ray> rays;
+    {
+        MeshPtr mesh_p = load_mesh();
+        if (!mesh_p->prepare())
+        {
+            std::cout << "mesh prepare falid" << std::endl;
+            return 1;
+        }
+        nyasRT::BoundingBox const box = mesh_p->bounding_box();
+        nyasRT::PCG_XSH_RR_32 rng(83u);
+        rays.reserve(n_rays);
+        for (u32 k = 0; k < n_rays; k++)
+        {
+            vec3g const origin = box.min_corner + (rng.uniform01<vec3g>() * fg(2) - fg(0.5)) * box.size();
+            vec3g const target = box.min_corner + rng.uniform01<vec3g>() * box.size();
+            rays.emplace_back(origin, normalize(target - origin));
+        }
+    }
+    std::cout << " -- " << n_rays << " random rays" << std::endl;
+
+    for (TriangleTest test : {TriangleTest::Projection, TriangleTest::MollerTrumbore, TriangleTest::Watertight})
+    {
+        for (u32 leaf_width : {1u, 4u, 8u})
+        {
+            MeshPtr mesh_p = load_mesh();
+            mesh_p->bvh_width = 4;
+            mesh_p->leaf_width = leaf_width;
+            mesh_p->triangle_test = test;
+            mesh_p->prepare();
+
+            u32 n_hits = 0, n_occluded = 0;
+            f32 const trace_time = nyasRT::timeit([&] ()
+            {
+                for (Ray const& ray : rays)
+                {
+                    TraceRecord rec;
+                    n_hits += mesh_p->trace(ray, rec);
+                }
+            });
+            f32 const test_hit_time = nyasRT::timeit([&] ()
+            {
+                for (Ray const& ray : rays) { n_occluded += mesh_p->test_hit(ray, nyasRT::consts<fg>::inf); }
+            });
+
+            // the rays to the vertices & middle of edges along the face normals, which must hit something on closed meshes.
+            // a ray leaked means the ray slips through the edges of faces
+            u32 n_edge_rays = 0, n_leaked = 0;
+            for (u32 face_index = 0; face_index < mesh_p->n_faces(); face_index += 7)
+            {
+                auto const vertex_indices = mesh_p->face(face_index);
+                vec3g const A = mesh_p->vertex(vertex_indices.x).position;
+                vec3g const B = mesh_p->vertex(vertex_indices.y).position;
+                vec3g const C = mesh_p->vertex(vertex_indices.z).position;
+                normal3g const normal = normalize(cross(B - A, C - A));
+                for (vec3g const& target : {A, B, C, (A + B) * fg(0.5), (B + C) * fg(0.5), (C + A) * fg(0.5)})
+                {
+                    TraceRecord rec;
+                    n_edge_rays++;
+                    n_leaked += !mesh_p->trace(Ray(target + normal, -normal), rec);
+                }
+            }
+
+            std::cout << " -- " << test_names[static_cast<u32>(test)] << ", leaf width " << leaf_width << ": "
+            << n_rays / trace_time * 1e-6f << " Mrays/s tracing, " << n_rays / test_hit_time * 1e-6f << " Mrays/s testing hit, "
+            << n_hits << " hits, " << n_occluded << " occluded, " << n_leaked << '/' << n_edge_rays << " edge rays leaked" << std::endl;
+        }
+    }
+    return 0;
+}
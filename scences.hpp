@@ -78,6 +78,44 @@ ScencePtr two_torus_interlocking(float tube_radius, unsigned n_a, unsigned n_b)
 }
 
 
+// a field of `n_side * n_side` randomly rotated torus instances, the material & brdf of `prototypes[0]` is needed to be set
+ScencePtr torus_field(float tube_radius, unsigned n_a, unsigned n_b, unsigned n_side)
+{
+    using namespace nyasRT::basic_types;
+    using nyasRT::consts, nyasRT::deg2rad;
+
+    auto scence_p = std::make_shared<nyasRT::Scence>();
+
+    auto mesh_p = nyasRT::Mesh::torus(tube_radius, n_a, n_b);
+    scence_p->prototypes.emplace_back(); scence_p->prototypes.back().mesh_p = mesh_p;
+
+    nyasRT::PCG_XSH_RR_32 rng(114514);
+    fg spacing = 3;
+    for (u32 i = 0; i < n_side; i++)
+    {
+        for (u32 j = 0; j < n_side; j++)
+        {
+            nyasRT::Transform transform;
+            transform.rotate(consts<vec3g>::X, rng.uniform01<fg>() * consts<fg>::two_pi)
+                .rotate(consts<vec3g>::Z, rng.uniform01<fg>() * consts<fg>::two_pi)
+                .scale(0.5 + rng.uniform01<fg>())
+                .shift(spacing * vec3g(fg(i) - fg(0.5) * n_side, fg(j) - fg(0.5) * n_side, 0));
+            scence_p->instances.emplace_back(transform, 0);
+        }
+    }
+
+    vec3g view_point = vec3g(0, -0.8 * spacing * n_side, 0.3 * spacing * n_side);
+    auto camera_p = std::make_shared<nyasRT::cameras::PerspectiveCamera>();
+    camera_p->view_origin(view_point).view_direction(-view_point).aspect_ratio(16.0f/9.0f).field_of_view(deg2rad(60.0));
+    scence_p->camera(camera_p);
+
+    auto sky_p = std::make_shared<nyasRT::sky_models::GradientSky>(nyasRT::remove_gamma(RGB(0.5f, 0.7f, 1.0f)), RGB(1.0f));
+    scence_p->sky(sky_p);
+
+    return scence_p;
+}
+
+
 nyasRT::GraphicsBuffer render_Hosek_sky_examples()
 {
 
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+    #define NYASRT_MMAP
+#endif
+
+#include "common.hpp"
+
+
+namespace nyasRT
+{
+// allocates memory aligned to `alignment` bytes
+template<class T, u64 alignment> class AlignedAllocator
+{
+public:
+
+    using value_type = T;
+    template<class U> struct rebind { using other = AlignedAllocator<U, alignment>; };
+
+    AlignedAllocator() noexcept = default;
+    template<class U> AlignedAllocator(AlignedAllocator<U, alignment> const&) noexcept {}
+
+    T * allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t{alignment}));
+    }
+    void deallocate(T * p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t{alignment});
+    }
+
+    template<class U> bool operator == (AlignedAllocator<U, alignment> const&) const noexcept { return true; }
+};
+
+
+// a read-only view of whole file, mapped into memory where `mmap` is available,
+// otherwise the file is read into a buffer. the data is aligned to `alignment` bytes at least either way
+class MappedFile final
+{
+public:
+
+    static constexpr u64 alignment = 64;
+
+private:
+
+    char const* _data;
+    u64 _size;
+    std::vector<char, AlignedAllocator<char, alignment>> _buffer;
+
+    void _close() noexcept
+    {
+#if defined(NYASRT_MMAP)
+        if (_buffer.empty() && (_data != nullptr)) { munmap(const_cast<char *>(_data), _size); }
+#endif
+        _buffer.clear();
+        _data = nullptr;
+        _size = 0;
+    }
+
+public:
+
+    MappedFile() noexcept
+    : _data{nullptr}, _size{0}, _buffer{} {}
+    explicit MappedFile(std::filesystem::path const& path, bool sequential = false)
+    : MappedFile()
+    {
+        open(path, sequential);
+    }
+    ~MappedFile() noexcept
+    {
+        _close();
+    }
+    MappedFile(MappedFile const&) = delete;
+    MappedFile & operator = (MappedFile const&) = delete;
+
+    /// @param sequential hint that the file will be read in order
+    bool open(std::filesystem::path const& path, bool sequential = false)
+    {
+        _close();
+#if defined(NYASRT_MMAP)
+        int const fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { return false; }
+        struct stat info;
+        if ((fstat(fd, &info) != 0) || (info.st_size <= 0)) { ::close(fd); return false; }
+
+        void * data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) { return false; }
+        if (sequential) { madvise(data, info.st_size, MADV_SEQUENTIAL); }
+        _data = static_cast<char const*>(data);
+        _size = info.st_size;
+        return true;
+#else
+        std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open()) { return false; }
+        _buffer.resize(file.tellg());
+        file.seekg(0);
+        file.read(_buffer.data(), _buffer.size());
+        if (_buffer.empty() || (u64(file.gcount()) != _buffer.size())) { _buffer.clear(); return false; }
+        _data = _buffer.data();
+        _size = _buffer.size();
+        return true;
+#endif
+    }
+
+    bool is_open() const noexcept
+    {
+        return _data != nullptr;
+    }
+    char const* data() const noexcept
+    {
+        return _data;
+    }
+    u64 size() const noexcept
+    {
+        return _size;
+    }
+    char const* begin() const noexcept
+    {
+        return _data;
+    }
+    char const* end() const noexcept
+    {
+        return _data + _size;
+    }
+};
+
+
+// an array which owns its elements in `std::vector`, or views read-only elements in memory of others,
+// e.g. a mapped file. the viewed elements are copied on the first modification
+template<class T> class MappedArray final
+{
+private:
+
+    std::vector<T> _vector;
+    T const* _data;     // the elements to read, either in `_vector` or viewed
+    u64 _size;
+    bool _viewing;
+
+    void _sync() noexcept
+    {
+        _data = _vector.data();
+        _size = _vector.size();
+    }
+    void _own()
+    {
+        if (_viewing)
+        {
+            _vector.assign(_data, _data + _size);
+            _viewing = false;
+            _sync();
+        }
+    }
+
+public:
+
+    MappedArray() noexcept
+    : _vector{}, _data{nullptr}, _size{0}, _viewing{false} {}
+    MappedArray(MappedArray const& array)
+    : _vector{array._vector}, _data{array._data}, _size{array._size}, _viewing{array._viewing}
+    {
+        if (!_viewing) { _sync(); }
+    }
+    MappedArray(MappedArray && array) noexcept
+    : _vector{std::move(array._vector)}, _data{array._data}, _size{array._size}, _viewing{array._viewing}
+    {
+        array._sync();
+    }
+    MappedArray & operator = (MappedArray array) noexcept
+    {
+        swap(array);
+        return *this;
+    }
+
+    // view `size` elements at `data`, which should outlive this array or its copies
+    MappedArray & view(T const* data, u64 size) noexcept
+    {
+        std::vector<T>().swap(_vector);
+        _data = data;
+        _size = size;
+        _viewing = true;
+        return *this;
+    }
+    bool viewing() const noexcept
+    {
+        return _viewing;
+    }
+
+    u64 size() const noexcept
+    {
+        return _size;
+    }
+    bool empty() const noexcept
+    {
+        return _size == 0;
+    }
+    T const* data() const noexcept
+    {
+        return _data;
+    }
+    T * data()
+    {
+        _own();
+        return _vector.data();
+    }
+
+    T const& operator[](u64 index) const noexcept
+    {
+        return _data[index];
+    }
+    T & operator[](u64 index)
+    {
+        _own();
+        return _vector[index];
+    }
+    T const& front() const noexcept
+    {
+        return _data[0];
+    }
+    T const& back() const noexcept
+    {
+        return _data[_size - 1];
+    }
+    T & back()
+    {
+        _own();
+        return _vector.back();
+    }
+
+    T const* begin() const noexcept
+    {
+        return _data;
+    }
+    T const* end() const noexcept
+    {
+        return _data + _size;
+    }
+    T * begin()
+    {
+        _own();
+        return _vector.data();
+    }
+    T * end()
+    {
+        _own();
+        return _vector.data() + _vector.size();
+    }
+
+    void push_back(T const& element)
+    {
+        _own();
+        _vector.push_back(element);
+        _sync();
+    }
+    template<class... Args> T & emplace_back(Args &&... args)
+    {
+        _own();
+        T & element = _vector.emplace_back(std::forward<Args>(args)...);
+        _sync();
+        return element;
+    }
+    void resize(u64 size)
+    {
+        _own();
+        _vector.resize(size);
+        _sync();
+    }
+    void reserve(u64 size)
+    {
+        _own();
+        _vector.reserve(size);
+        _sync();
+    }
+    void clear() noexcept
+    {
+        _vector.clear();
+        _viewing = false;
+        _sync();
+    }
+
+    void swap(MappedArray & array) noexcept
+    {
+        std::swap(_vector, array._vector);
+        std::swap(_data, array._data);
+        std::swap(_size, array._size);
+        std::swap(_viewing, array._viewing);
+    }
+    void swap(std::vector<T> & vector)
+    {
+        _own();
+        _vector.swap(vector);
+        _sync();
+    }
+};
+
+} // namespace nyasRT
@@ -6,6 +6,10 @@
 #include <numeric>
 #include <thread>
 
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#endif
+
 #include "common.hpp"
 
 
@@ -67,6 +71,15 @@ public:
 static thread_local PCG_XSH_RR_32 pcg;
 
 
+// stateless hash of a single PCG step, see "Hash Functions for GPU Rendering" by Jarzynski & Olano
+constexpr inline u32 pcg_hash(u32 x) noexcept
+{
+    u32 const state = x * 747796405u + 2891336453u;
+    u32 const word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+    return (word >> 22) ^ word;
+}
+
+
 /******** generation of common types ********/
 
 inline void _keep_period_or_not(PCG_XSH_RR_32 & rng) noexcept
@@ -199,4 +212,131 @@ public:
     }
 };
 
+
+/******** batched generation ********/
+
+// 8 streams of `PCG_XSH_RR_32` stepped together with AVX2,
+// lane `k` produces the same numbers as `PCG_XSH_RR_32(lane_seed(seed, k))`
+class PCG_XSH_RR_32x8 final
+{
+public:
+
+    static constexpr u32 lanes = 8;
+
+    alignas(32) u64 _increment[lanes];
+    alignas(32) u64 _state[lanes];
+
+    static constexpr u64 lane_seed(u64 seed, u32 lane) noexcept
+    {
+        return seed ^ (lane * 0x9E3779B97F4A7C15);
+    }
+
+    PCG_XSH_RR_32x8() noexcept
+    : PCG_XSH_RR_32x8(PCG_XSH_RR_32::_default_seeding()) {}
+    explicit PCG_XSH_RR_32x8(u64 seed) noexcept
+    {
+        for (u32 k = 0; k < lanes; k++)
+        {
+            u64 const lseed = lane_seed(seed, k);
+            _increment[k] = (lseed << 1) | 1;
+            _state[k] = lseed;
+        }
+    }
+
+#if defined(__AVX2__)
+    // call `consume(__m256i)` with one number of each lane for `n_rounds` times, states are kept in registers meanwhile
+    template<class F> void _generate(u64 n_rounds, F && consume) noexcept
+    {
+        // 64-bit multiplication from 32-bit ones, since AVX2 has no `mullo_epi64`
+        __m256i const mul_lo = _mm256_set1_epi64x(PCG_XSH_RR_32::multiplier & 0xFFFFFFFF);
+        __m256i const mul_hi = _mm256_set1_epi64x(PCG_XSH_RR_32::multiplier >> 32);
+        auto const step = [mul_lo, mul_hi] (__m256i state, __m256i increment) noexcept -> __m256i
+        {
+            __m256i const lo = _mm256_mul_epu32(state, mul_lo);
+            __m256i const cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(state, 32), mul_lo), _mm256_mul_epu32(state, mul_hi));
+            return _mm256_add_epi64(_mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32)), increment);
+        };
+        // gather the low 32 bits of 4 + 4 64-bit lanes
+        auto const pack = [] (__m256i a, __m256i b) noexcept -> __m256i
+        {
+            a = _mm256_permute4x64_epi64(_mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 0, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+            b = _mm256_permute4x64_epi64(_mm256_shuffle_epi32(b, _MM_SHUFFLE(2, 0, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+            return _mm256_permute2x128_si256(a, b, 0x20);
+        };
+
+        __m256i state_a = _mm256_load_si256(reinterpret_cast<__m256i const*>(_state));
+        __m256i state_b = _mm256_load_si256(reinterpret_cast<__m256i const*>(_state + 4));
+        __m256i const increment_a = _mm256_load_si256(reinterpret_cast<__m256i const*>(_increment));
+        __m256i const increment_b = _mm256_load_si256(reinterpret_cast<__m256i const*>(_increment + 4));
+
+        for (; n_rounds > 0; n_rounds--)
+        {
+            state_a = step(state_a, increment_a);
+            state_b = step(state_b, increment_b);
+
+            __m256i const xorshifted = pack(_mm256_srli_epi64(_mm256_xor_si256(state_a, _mm256_srli_epi64(state_a, 18)), 27),
+                                            _mm256_srli_epi64(_mm256_xor_si256(state_b, _mm256_srli_epi64(state_b, 18)), 27));
+            __m256i const rot = pack(_mm256_srli_epi64(state_a, 59), _mm256_srli_epi64(state_b, 59));
+            __m256i const rot_l = _mm256_and_si256(_mm256_sub_epi32(_mm256_set1_epi32(32), rot), _mm256_set1_epi32(31));
+            consume(_mm256_or_si256(_mm256_srlv_epi32(xorshifted, rot), _mm256_sllv_epi32(xorshifted, rot_l)));
+        }
+
+        _mm256_store_si256(reinterpret_cast<__m256i *>(_state), state_a);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(_state + 4), state_b);
+    }
+#endif
+
+    // one number of each lane
+    void get(u32 * out) noexcept
+    {
+#if defined(__AVX2__)
+        _generate(1, [out] (__m256i bits) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), bits); });
+#else
+        for (u32 k = 0; k < lanes; k++)
+        {
+            _state[k] = _state[k] * PCG_XSH_RR_32::multiplier + _increment[k];
+            out[k] = std::rotr(static_cast<u32>((_state[k] ^ (_state[k] >> 18)) >> 27), static_cast<i32>(_state[k] >> 59));
+        }
+#endif
+    }
+
+    void randbits(u32 * out, u64 n) noexcept
+    {
+#if defined(__AVX2__)
+        _generate(n / lanes, [&out] (__m256i bits) noexcept
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), bits);
+            out += lanes;
+        });
+#else
+        for (; n >= lanes; n -= lanes, out += lanes) { get(out); }
+#endif
+        if (n % lanes != 0)
+        {
+            u32 tmp[lanes];
+            get(tmp);
+            std::copy(tmp, tmp + n % lanes, out);
+        }
+    }
+    // numbers in [0,1)
+    void uniform01(f32 * out, u64 n) noexcept
+    {
+#if defined(__AVX2__)
+        __m256 const scaler = _mm256_set1_ps(0x1p-24f);
+        _generate(n / lanes, [&out, scaler] (__m256i bits) noexcept
+        {
+            _mm256_storeu_ps(out, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits, 8)), scaler));
+            out += lanes;
+        });
+        n %= lanes;
+#endif
+        u32 bits[lanes];
+        for (; n > 0; n -= std::min<u64>(n, lanes), out += lanes)
+        {
+            get(bits);
+            for (u32 k = 0; k < std::min<u64>(n, lanes); k++) { out[k] = static_cast<f32>(bits[k] >> 8) * 0x1p-24f; }
+        }
+    }
+};
+
 } // namespace nyasRT
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <math.h>
 #include <mutex>
 #include <thread>
@@ -11,6 +14,7 @@
 #include "graphics/GraphicsBuffer.hpp"
 #include "graphics/DisplayWindow.hpp"
 #include "components/Object3D.hpp"
+#include "components/StaticDispatch.hpp"
 #include "Sampler.hpp"
 #include "Scence.hpp"
 
@@ -24,6 +28,34 @@ public:
     SampleType sample_type;
     u32 n_sample_sets;
     u32 rays_pre_pixel, max_ray_bounds;
+
+    // shoot rays in passes of `adaptive_pass_rays` and stop once the standard error of pixel luminance
+    // is lower than `adaptive_error` times its mean. each pixel first takes at most `rays_pre_pixel` rays,
+    // then the rays saved by converged pixels are shared by the noisy ones in a second pass of `render`,
+    // at most `Renderer::adaptive_max_scale` times `rays_pre_pixel` each
+    bool adaptive_sampling = false;
+    u32 adaptive_pass_rays = 32;
+    f32 adaptive_error = 0.02f;
+
+    // render tasks in wavefronts of at most `wavefront_size` paths per thread instead of path by path,
+    // adaptive sampling is ignored in this mode
+    bool wavefront = false;
+    u32 wavefront_size = 1 << 14;
+
+    // terminate paths randomly after `roulette_min_bounds` bounds, the survival probability is
+    // the max channel of path throughput clamped by `roulette_max_survival`, survived paths are reweighted
+    bool russian_roulette = false;
+    u32 roulette_min_bounds = 3;
+    f32 roulette_max_survival = 0.95f;
+
+    // random numbers only depend on pixel, sample index & dimension, so that renders are reproducible for any threads
+    bool deterministic = false;
+
+    // weight light sampling & BRDF sampling by the power heuristic, so that lights hit by bounced rays are also rendered
+    bool multiple_importance_sampling = false;
+
+    // sample the sky as a light source if it is baked, see `Sky::bake`, only work with `multiple_importance_sampling`
+    bool sample_sky = false;
 };
 
 
@@ -37,18 +69,19 @@ protected:
     static index2_t const task_size;
 #endif
 
+    // tasks are taken by threads through an atomic cursor, so no lock is needed
     class TasksManager final
     {
     private:
 
         index2_t * tasks;
-        index2_t * next_task;
         index2_t * tasks_stop;
+        std::atomic<u64> next_task;
 
     public:
 
         TasksManager(GraphicsBuffer const& gbuf)
-        : tasks{nullptr}, next_task{nullptr}, tasks_stop{nullptr} {
+        : tasks{nullptr}, tasks_stop{nullptr}, next_task{0} {
             index2_t const gsize = gbuf.size();
             index2_t const center = gsize >> 1;
             index2_t start_start = center % task_size;
@@ -57,17 +90,17 @@ protected:
 
             index2_t const tmp = (gsize - 1 - start_start) / task_size + 1;
             u32 total_tasks = tmp.x * tmp.y;
-            tasks = next_task = new index2_t[total_tasks];
+            tasks = new index2_t[total_tasks];
             tasks_stop = tasks + total_tasks;
 
+            index2_t * task = tasks;
             for (i64 start_y = start_start.y; start_y < gbuf.height(); start_y += task_size.y)
             {
                 for (i64 start_x = start_start.x; start_x < gbuf.width(); start_x += task_size.x)
                 {
-                    *(next_task++) = index2_t(start_x, start_y);
+                    *(task++) = index2_t(start_x, start_y);
                 }
             }
-            next_task = tasks;
 
             std::sort(tasks, tasks_stop, [center] (index2_t l, index2_t r) noexcept -> bool
             {
@@ -87,12 +120,16 @@ protected:
 
         bool empty() const noexcept
         {
-            return next_task >= tasks_stop;
+            return next_task.load(std::memory_order_relaxed) >= u64(tasks_stop - tasks);
         }
 
-        index2_t take() noexcept
+        // return false if all tasks are taken
+        bool take(index2_t & task) noexcept
         {
-            return *(next_task++);
+            u64 const index = next_task.fetch_add(1, std::memory_order_relaxed);
+            if (index >= u64(tasks_stop - tasks)) { return false; }
+            task = tasks[index];
+            return true;
         }
     };
 
@@ -103,113 +140,384 @@ protected:
 
     static constexpr f32 display_framerate = 30;
 
+    static constexpr f32 adaptive_min_luminance = 1e-3f;   // avoid dark pixels never converge
+    static constexpr u32 adaptive_max_scale = 8;            // noisy pixels take at most this times `rays_pre_pixel`
+
 
     Scence const& _scence;
 
-public:
 
-    RenderConfig config;
+    // a path in flight of wavefront rendering
+    class PathState final
+    {
+    public:
 
-    Renderer(Scence const& scence_) noexcept
-    : _scence{scence_}, config{SampleType::Random, 0, 0, 0} {}
-    Renderer(Scence const& scence_, RenderConfig config_) noexcept
-    : _scence{scence_}, config{config_} {}
+        Ray ray;
+        TraceRecord rec;
+        u32 pixel;  // the linear index in task
+        u32 bounds;
+        Sampler::PathState sampler_path;
+    };
 
-    RGB render_pixel(vec2g const& pixel_center, vec2g const& pixel_size) const noexcept
+    // the running estimate of a pixel in adaptive sampling
+    class PixelEstimate final
     {
-        RGB pixel_color = consts<RGB>::Black;
+    public:
 
-        for (u32 k = 0; k < config.rays_pre_pixel; k++)
+        RGB color_sum = consts<RGB>::Black;
+        f32 mean = 0, m2 = 0;   // running mean & sum of squared deviations of luminance
+        u32 n_rays = 0;
+        bool converged = false;
+
+        void add(RGB const& color) noexcept
         {
-            vec2g position = pixel_center + pixel_size * (sampler.get() - fg(0.5));
-            pixel_color += render_screen(position);
+            color_sum += color;
+            n_rays++;
+            f32 l = luminance(color);
+            f32 delta = l - mean;
+            mean += delta / f32(n_rays);
+            m2 += delta * (l - mean);
         }
-        return pixel_color / f32(config.rays_pre_pixel);
+        RGB color() const noexcept
+        {
+            return (n_rays > 0) ? color_sum / f32(n_rays) : consts<RGB>::Black;
+        }
+    };
+
+
+    // the weight of a sample from the strategy with density `pdf` against the one with `other_pdf`
+    static constexpr f32 power_heuristic(f32 pdf, f32 other_pdf) noexcept
+    {
+        if (std::isinf(pdf)) { return 1; }
+        f32 const pp = sqr(pdf), sum = pp + sqr(other_pdf);
+        return (sum > 0) ? pp / sum : 0;
+    }
+
+    // trace ray and render lights on screen, lights hit by bounced rays are weighted against light sampling
+    void _trace_path(Ray const& ray, TraceRecord & rec, u32 bounds) const noexcept
+    {
+        rec.reset();
+        _scence.trace(ray, rec);
+#ifdef NYASRT_SHOW_TRACE_INFO
+        rec.trace_count++;
+#endif
+
+        if ((bounds > 0) && !(rec.bounds_pdf > 0)) { return; }
+        for (LightSourceDispatch const& light_d : _scence.light_dispatches()) light_d.visit([&] (auto const& source)
+        {
+            if (!source.test_hit(ray, rec.max_ray_time)) { return; }
+            if (bounds == 0) { rec.ray_color += source.light(ray); return; }
+
+            f32 light_pdf = source.pdf(ray.origin, ray.direction);
+            rec.ray_color += rec.reflect_color * source.light(ray) * (light_pdf * power_heuristic(rec.bounds_pdf, light_pdf));
+        });
     }
-    RGB render_screen(vec2g const& position) const noexcept
+
+    // render the hit surface and bounds the ray
+    void _shade_path(Ray & ray, TraceRecord & rec) const noexcept
+    {
+        rec.object_p->brdf_d.visit([&] (auto const& brdf) { _shade_path(brdf, ray, rec); });
+    }
+    // the shading kernel instantiated for each built-in BRDF, see `StaticDispatch`
+    template<class BRDFType> void _shade_path(BRDFType const& brdf, Ray & ray, TraceRecord & rec) const noexcept
     {
         using glm::normalize;
-        [[maybe_unused]] VEC_CONST RGB trace_info_scaler = RGB(trace_info_max_bbox_count, trace_info_max_face_count, trace_info_max_trace_count);
 
-        Ray ray = _scence.camera_ref().cast_ray(position);
-        TraceRecord rec;
-        u32 bounds = 0;
-        RGB received;
+        // get surface material color
+        RGB surface_color = rec.object_p->material_d.visit([&] (auto const& material) { return material(ray, rec); });
 
-        while (true)
+        // next bounds direction
+        rec.hit_normal = normalize(rec.hit_normal);
+        auto [outgoing, reflected] = brdf.bounds(surface_color, ray, rec);
+
+        // render object surface
+        RGB received = brdf.emitted(surface_color, ray, rec);
+
+        // render_lights
+        Ray light_ray; light_ray.origin = rec.hit_point;
+        for (LightSourceDispatch const& light_d : _scence.light_dispatches()) light_d.visit([&] (auto const& source)
         {
-            // tracing ray
-            rec.reset();
-            _scence.trace(ray, rec);
-#ifdef NYASRT_SHOW_TRACE_INFO
-            rec.trace_count++;
-#endif
+            auto [direction, max_light_ray_time] = source.sample(light_ray.origin);
+            light_ray.direction = direction;
 
-            // directly render lights on screen
-            if (bounds == 0) for (auto const& light_p : _scence.light_ps)
+            f32 l_dot_n = dot(light_ray.direction, rec.hit_normal);
+            if ((l_dot_n > 0) && !_scence.test_hit(light_ray, max_light_ray_time))
             {
-                if (light_p->test_hit(ray, rec.max_ray_time))
+                RGB surface_brdf = brdf(surface_color, light_ray.direction, -ray.direction, rec.hit_normal);
+                f32 weight = 1;
+                if (config.multiple_importance_sampling)
                 {
-                    rec.ray_color += light_p->light(ray);
+                    f32 light_pdf = source.pdf(light_ray.origin, light_ray.direction);
+                    weight = power_heuristic(light_pdf, brdf.pdf(light_ray.direction, -ray.direction, rec.hit_normal));
                 }
+                received += surface_brdf * l_dot_n * source.light(light_ray) * weight;
             }
+#ifdef NYASRT_SHOW_TRACE_INFO
+            rec.trace_count++;
+#endif
+        });
 
-            if ((bounds < config.max_ray_bounds) && rec.hit_object())
+        // render sky as light
+        if (_sample_sky())
+        {
+            sky_models::Sky const& sky = _scence.sky_ref();
+            auto [direction, sky_pdf] = sky.sample(sampler.uniform01<vec2g>());
+            light_ray.direction = direction;
+
+            f32 l_dot_n = dot(light_ray.direction, rec.hit_normal);
+            if ((l_dot_n > 0) && (sky_pdf > 0) && !_scence.test_hit(light_ray, consts<fg>::inf))
             {
-                // get surface material color
-                RGB surface_color = (*rec.object_p->material_p)(ray, rec);
+                RGB surface_brdf = brdf(surface_color, light_ray.direction, -ray.direction, rec.hit_normal);
+                f32 weight = power_heuristic(sky_pdf, brdf.pdf(light_ray.direction, -ray.direction, rec.hit_normal));
+                received += surface_brdf * l_dot_n * sky.radiance(light_ray.direction) * (weight / sky_pdf);
+            }
+#ifdef NYASRT_SHOW_TRACE_INFO
+            rec.trace_count++;
+#endif
+        }
+
+        // ray bounds
+        rec.ray_color += rec.reflect_color * received;
+        rec.reflect_color *= reflected;
+        rec.bounds_pdf = config.multiple_importance_sampling ? brdf.pdf(outgoing, -ray.direction, rec.hit_normal) : 0;
+        rec.cone_width += rec.cone_spread * rec.max_ray_time;   // the spread angle is kept as surfaces are assumed flat
+        ray.origin = rec.hit_point;
+        ray.direction = outgoing;
+    }
+
+    // return false if the path is terminated by russian roulette, it keeps unbiased since the survived are reweighted
+    bool _roulette_path(TraceRecord & rec, u32 bounds) const noexcept
+    {
+        if (!config.russian_roulette || (bounds < config.roulette_min_bounds)) { return true; }
+
+        f32 survival = std::max(std::max(rec.reflect_color.r, rec.reflect_color.g), rec.reflect_color.b);
+        survival = std::min(survival, config.roulette_max_survival);
+        if (!(sampler.uniform01<f32>() < survival)) { return false; }
+
+        rec.reflect_color /= survival;
+        return true;
+    }
+
+    bool _sample_sky() const noexcept
+    {
+        return config.multiple_importance_sampling && config.sample_sky && _scence.has_sky() && _scence.sky_ref().baked();
+    }
+
+    // render sky and get the final color of path, the sky seen by bounced rays is weighted against sky sampling
+    RGB _finish_path(Ray const& ray, TraceRecord & rec) const noexcept
+    {
+        [[maybe_unused]] VEC_CONST RGB trace_info_scaler = RGB(trace_info_max_bbox_count, trace_info_max_face_count, trace_info_max_trace_count);
 
-                // next bounds direction
-                rec.hit_normal = normalize(rec.hit_normal);
-                auto [outgoing, reflected] = rec.object_p->brdf_p->bounds(surface_color, ray, rec);
+        if (!rec.hit_object() && _scence.has_sky())
+        {
+            sky_models::Sky const& sky = _scence.sky_ref();
+            f32 weight = (_sample_sky() && (rec.bounds_pdf > 0)) ? power_heuristic(rec.bounds_pdf, sky.pdf(ray.direction)) : 1;
+            rec.ray_color += rec.reflect_color * sky.radiance(ray.direction) * weight;
+        }
+#ifdef NYASRT_SHOW_TRACE_INFO
+        return RGB(rec.box_count, rec.triangle_count, rec.trace_count) / trace_info_scaler;
+#endif
+        return rec.ray_color;
+    }
 
-                // render object surface
-                received = rec.object_p->brdf_p->emitted(surface_color, ray, rec);
+    // render a task with paths in batches: all paths are traced, then terminated paths are removed,
+    // and the rests are sorted by their BRDF & material before shading
+    void _render_task_wavefront(SubBuffer & task) const
+    {
+        u32 const n_pixels = task.total();
+        u64 const n_paths = u64(n_pixels) * config.rays_pre_pixel;
+        u32 const batch_size = std::max(config.wavefront_size, 1u);
+        vec2g const pixel_size = task.buffer().pixel_size();
+        fg const cone_spread = _scence.camera_ref().spread_angle(pixel_size);
+
+        std::vector<RGB> pixel_colors(n_pixels, consts<RGB>::Black);
+        std::vector<PathState> paths, next_paths;
+        std::vector<u32> to_shade;
+        paths.reserve(std::min<u64>(batch_size, n_paths));
+        next_paths.reserve(paths.capacity());
+        to_shade.reserve(paths.capacity());
+
+        for (u64 batch_start = 0; batch_start < n_paths; batch_start += batch_size)
+        {
+            // generate camera rays
+            u64 const batch_stop = std::min<u64>(batch_start + batch_size, n_paths);
+            paths.clear();
+            for (u64 path_index = batch_start; path_index < batch_stop; path_index++)
+            {
+                PathState & path = paths.emplace_back();
+                path.pixel = path_index / config.rays_pre_pixel;
+                path.bounds = 0;
+
+                index2_t const local_index = index2_t(path.pixel % task.width(), path.pixel / task.width());
+                vec2g const center = task.buffer().position(local_index + task.offset());
+                sampler.start(Sampler::seed_of(center), path_index % config.rays_pre_pixel);
+                vec2g position = center + pixel_size * (sampler.get() - fg(0.5));
+                path.ray = _scence.camera_ref().cast_ray(position);
+                path.rec.cone_spread = cone_spread;
+                path.sampler_path = sampler.path();
+            }
 
-                // render_lights
-                Ray light_ray; light_ray.origin = rec.hit_point;
-                for (auto const& light_p : _scence.light_ps)
+            while (!paths.empty())
+            {
+                for (PathState & path : paths)
                 {
-                    auto [direction, max_light_ray_time] = light_p->sample(light_ray.origin);
-                    light_ray.direction = direction;
+                    _trace_path(path.ray, path.rec, path.bounds);
+                }
 
-                    f32 l_dot_n = dot(light_ray.direction, rec.hit_normal);
-                    if ((l_dot_n > 0) && !_scence.test_hit(light_ray, max_light_ray_time))
+                // finish terminated paths
+                to_shade.clear();
+                for (u32 k = 0; k < paths.size(); k++)
+                {
+                    PathState & path = paths[k];
+                    if ((path.bounds < config.max_ray_bounds) && path.rec.hit_object()) { to_shade.emplace_back(k); }
+                    else { pixel_colors[path.pixel] += _finish_path(path.ray, path.rec); }
+                }
+
+                // sort hits so that the same virtual functions are called in a row
+                std::sort(to_shade.begin(), to_shade.end(), [&paths] (u32 l, u32 r) noexcept -> bool
+                {
+                    Object3D const& lo = *paths[l].rec.object_p;
+                    Object3D const& ro = *paths[r].rec.object_p;
+                    if (lo.brdf_p != ro.brdf_p) { return lo.brdf_p < ro.brdf_p; }
+                    return lo.material_p < ro.material_p;
+                });
+
+                // shade & compact survived paths
+                next_paths.clear();
+                for (u32 k : to_shade)
+                {
+                    PathState & path = next_paths.emplace_back(paths[k]);
+                    sampler.path(path.sampler_path);
+                    _shade_path(path.ray, path.rec);
+                    path.bounds++;
+                    if (!_roulette_path(path.rec, path.bounds))
                     {
-                        RGB surface_brdf = (*rec.object_p->brdf_p)(surface_color, light_ray.direction, -ray.direction, rec.hit_normal);
-                        received += surface_brdf * l_dot_n * light_p->light(light_ray);
+                        pixel_colors[path.pixel] += _finish_path(path.ray, path.rec);
+                        next_paths.pop_back();
+                        continue;
                     }
-#ifdef NYASRT_SHOW_TRACE_INFO
-                    rec.trace_count++;
-#endif
+                    path.sampler_path = sampler.path();
                 }
+                std::swap(paths, next_paths);
+            }
+        }
+
+        for (u32 pixel = 0; pixel < n_pixels; pixel++)
+        {
+            task[pixel] = pixel_colors[pixel] / f32(config.rays_pre_pixel);
+        }
+    }
+
+    // continue shooting rays to `estimate` in passes until it converges or takes `max_rays`
+    void _render_pixel_adaptive(vec2g const& pixel_center, vec2g const& pixel_size, PixelEstimate & estimate, u32 max_rays) const noexcept
+    {
+        u32 const pass_rays = std::max(config.adaptive_pass_rays, 2u);
+        u32 const seed = Sampler::seed_of(pixel_center);
+        fg const cone_spread = _scence.camera_ref().spread_angle(pixel_size);
+        while (!estimate.converged && (estimate.n_rays < max_rays))
+        {
+            u32 const stop = std::min(estimate.n_rays + pass_rays, max_rays);
+            for (u32 k = estimate.n_rays; k < stop; k++)
+            {
+                sampler.start(seed, k);
+                vec2g position = pixel_center + pixel_size * (sampler.get() - fg(0.5));
+                estimate.add(render_screen(position, cone_spread));
+            }
+
+            f32 n = f32(estimate.n_rays);
+            f32 std_error = std::sqrt(estimate.m2 / (n * (n - 1)));
+            estimate.converged = std_error <= config.adaptive_error * std::max(estimate.mean, adaptive_min_luminance);
+        }
+    }
+    // render the pixels of task adaptively, the converged ones are skipped so that the second pass only takes noisy pixels
+    void _render_task_adaptive(GraphicsBuffer const& gbuf, SubBuffer & task, std::vector<PixelEstimate> & estimates, u32 max_rays) const noexcept
+    {
+        vec2g pixel_size = gbuf.pixel_size();
+        for (auto & iter : task)
+        {
+            index2_t const index = iter.global_index();
+            PixelEstimate & estimate = estimates[index.x + u64(index.y) * gbuf.width()];
+            if (estimate.converged) { continue; }
+            _render_pixel_adaptive(gbuf.position(index), pixel_size, estimate, max_rays);
+            iter.pixel() = estimate.color();
+        }
+    }
+    // share the rays saved by converged pixels to the noisy ones, so that the total is still `rays_pre_pixel` per pixel
+    u32 _adaptive_max_rays(std::vector<PixelEstimate> const& estimates) const noexcept
+    {
+        u64 used = 0, n_noisy = 0;
+        for (PixelEstimate const& estimate : estimates)
+        {
+            used += estimate.n_rays;
+            n_noisy += !estimate.converged;
+        }
+        if (n_noisy == 0) { return config.rays_pre_pixel; }
+        u64 const saved = u64(config.rays_pre_pixel) * estimates.size() - used;
+        return u32(std::min<u64>(config.rays_pre_pixel + saved / n_noisy, u64(config.rays_pre_pixel) * adaptive_max_scale));
+    }
+
+public:
+
+    RenderConfig config;
+
+    Renderer(Scence const& scence_) noexcept
+    : _scence{scence_}, config{SampleType::Random, 0, 0, 0} {}
+    Renderer(Scence const& scence_, RenderConfig config_) noexcept
+    : _scence{scence_}, config{config_} {}
+
+    RGB render_pixel(vec2g const& pixel_center, vec2g const& pixel_size) const noexcept
+    {
+        if (config.adaptive_sampling) { return render_pixel_adaptive(pixel_center, pixel_size); }
+        RGB pixel_color = consts<RGB>::Black;
+
+        u32 const seed = Sampler::seed_of(pixel_center);
+        fg const cone_spread = _scence.camera_ref().spread_angle(pixel_size);
+        for (u32 k = 0; k < config.rays_pre_pixel; k++)
+        {
+            sampler.start(seed, k);
+            vec2g position = pixel_center + pixel_size * (sampler.get() - fg(0.5));
+            pixel_color += render_screen(position, cone_spread);
+        }
+        return pixel_color / f32(config.rays_pre_pixel);
+    }
+    // a single pixel stops early once converged, at most `rays_pre_pixel` rays since no budget is shared
+    RGB render_pixel_adaptive(vec2g const& pixel_center, vec2g const& pixel_size) const noexcept
+    {
+        PixelEstimate estimate;
+        _render_pixel_adaptive(pixel_center, pixel_size, estimate, config.rays_pre_pixel);
+        return estimate.color();
+    }
+    /// @param cone_spread the spread angle of ray cone for texture filtering, see `Camera::spread_angle`
+    RGB render_screen(vec2g const& position, fg cone_spread = 0) const noexcept
+    {
+        Ray ray = _scence.camera_ref().cast_ray(position);
+        TraceRecord rec;
+        rec.cone_spread = cone_spread;
+        u32 bounds = 0;
+
+        while (true)
+        {
+            _trace_path(ray, rec, bounds);
 
-                // ray bounds
-                rec.ray_color += rec.reflect_color * received;
-                rec.reflect_color *= reflected;
-                ray.origin = rec.hit_point;
-                ray.direction = outgoing;
+            if ((bounds < config.max_ray_bounds) && rec.hit_object())
+            {
+                _shade_path(ray, rec);
                 bounds++;
+                // no sky is added since the path still hits object
+                if (!_roulette_path(rec, bounds)) { return _finish_path(ray, rec); }
             }
             else
             {
-                // render sky
-                if (!rec.hit_object() && _scence.has_sky())
-                {
-                    rec.ray_color += rec.reflect_color * _scence.sky_ref()(ray.direction);
-                }
-#ifdef NYASRT_SHOW_TRACE_INFO
-                return RGB(rec.box_count, rec.triangle_count, rec.trace_count) / trace_info_scaler;
-#endif
-                return rec.ray_color;
+                return _finish_path(ray, rec);
             }
         }
     }
 
-    void render(GraphicsBuffer & gbuf) const noexcept
+    void render(GraphicsBuffer & gbuf) const
     {
         if (!_scence.prepared()) { return; }
-        sampler.init(config.sample_type, config.n_sample_sets, config.rays_pre_pixel);
+        if (config.wavefront) { return render(gbuf, 1); }
+        sampler.init(config.sample_type, config.n_sample_sets, config.rays_pre_pixel, config.deterministic);
 
 #if defined(NYASRT_DISPLAY_PROGRESS)
         using namespace std::chrono;
@@ -224,6 +532,19 @@ public:
 
         vec2g pixel_size = gbuf.pixel_size();
 
+        if (config.adaptive_sampling)
+        {
+            // all pixels in the first pass, then the noisy ones with the saved rays
+            std::vector<PixelEstimate> estimates(gbuf.total());
+            SubBuffer iterator(gbuf);
+            _render_task_adaptive(gbuf, iterator, estimates, config.rays_pre_pixel);
+#if defined(NYASRT_DISPLAY_PROGRESS)
+            window.refresh();
+#endif
+            _render_task_adaptive(gbuf, iterator, estimates, _adaptive_max_rays(estimates));
+            return;
+        }
+
         for (SubBuffer iterator(gbuf); auto & iter : iterator)
         {
             vec2g center = gbuf.position(iter.global_index());
@@ -262,62 +583,86 @@ public:
         auto next_refresh_time = system_clock::now() + refresh_interval;
 #endif
 
-        std::vector<bool> threads_done;
-        std::vector<std::thread> threads;
-        threads_done.reserve(n_threads);
-        threads.reserve(n_threads);
-
         vec2g pixel_size = gbuf.pixel_size();
-        TasksManager manager(gbuf);
-        std::mutex request_task;
 
-        for (u32 k = 0; k < n_threads; k++)
+        // generate the shared sample pattern before threads start, so that threads only take it
+        if (config.sample_type != SampleType::Sobol) { Sampler::shared_pattern(config.sample_type, config.n_sample_sets, config.rays_pre_pixel); }
+
+        // render all tiles by `render_task` in threads, return once all tiles are done
+        auto render_tasks = [&, this] (auto const& render_task)
         {
-            threads_done.emplace_back(false);
-            threads.emplace_back([&, this, k] () noexcept
-            {
-                sampler.init(config.sample_type, config.n_sample_sets, config.rays_pre_pixel);
-                index2_t task_start;
+            std::vector<std::thread> threads;
+            threads.reserve(n_threads);
+            TasksManager manager(gbuf);
+
+            // only used to wake up the main thread when all threads are done
+            std::mutex done_mutex;
+            std::condition_variable done_cv;
+            u32 n_done = 0;
 
-                while (true)
+            for (u32 k = 0; k < n_threads; k++)
+            {
+                threads.emplace_back([&, this] () noexcept
                 {
-                    /* requesting task */ {
-                        std::lock_guard<std::mutex> lock(request_task);
-                        if (manager.empty()) { break; }
+                    sampler.init(config.sample_type, config.n_sample_sets, config.rays_pre_pixel, config.deterministic);
+                    index2_t task_start;
 
-                        task_start = manager.take();
+                    while (manager.take(task_start))
+                    {
+                        SubBuffer iterator(gbuf, task_start, task_size);
+                        iterator.clamp();
+                        render_task(iterator);
                     }
 
-                    SubBuffer iterator(gbuf, task_start, task_size);
-                    iterator.clamp();
-                    for (auto & iter : iterator)
-                    {
-                        vec2g center = gbuf.position(iter.global_index());
-                        iter.pixel() = render_pixel(center, pixel_size);
+                    /* notify main thread */ {
+                        std::lock_guard<std::mutex> lock(done_mutex);
+                        n_done++;
                     }
+                    done_cv.notify_one();
+                });
+            }
+
+            /* wait for all threads done */ {
+                std::unique_lock<std::mutex> lock(done_mutex);
+#if defined(NYASRT_DISPLAY_PROGRESS)
+                while (!done_cv.wait_until(lock, next_refresh_time, [&] () noexcept { return n_done >= n_threads; }))
+                {
+                    window.refresh();
+                    next_refresh_time += refresh_interval;
                 }
+#else
+                done_cv.wait(lock, [&] () noexcept { return n_done >= n_threads; });
+#endif
+            }
+            for (std::thread & thread : threads) { thread.join(); }
+        };
 
-                threads_done[k] = true;
-            });
+        if (config.wavefront)
+        {
+            render_tasks([this] (SubBuffer & iterator) { _render_task_wavefront(iterator); });
         }
-
-        u32 thread_index = 0;
-        while (thread_index < n_threads)
+        else if (config.adaptive_sampling)
         {
-            if (threads_done[thread_index])
-            {
-                threads[thread_index].join();
-                thread_index++;
-            }
-
-#if defined(NYASRT_DISPLAY_PROGRESS)
-            if (system_clock::now() >= next_refresh_time)
+            // all pixels in the first pass, then the noisy ones with the saved rays
+            std::vector<PixelEstimate> estimates(gbuf.total());
+            u32 max_rays = config.rays_pre_pixel;
+            auto render_task = [&, this] (SubBuffer & iterator) { _render_task_adaptive(gbuf, iterator, estimates, max_rays); };
+            render_tasks(render_task);
+            max_rays = _adaptive_max_rays(estimates);
+            render_tasks(render_task);
+        }
+        else
+        {
+            render_tasks([&, this] (SubBuffer & iterator)
             {
-                window.refresh();
-                next_refresh_time += refresh_interval;
-            }
-#endif
+                for (auto & iter : iterator)
+                {
+                    vec2g center = gbuf.position(iter.global_index());
+                    iter.pixel() = render_pixel(center, pixel_size);
+                }
+            });
         }
+
 #if defined(NYASRT_DISPLAY_PROGRESS)
         // wait for window closed
         /* while (!window.should_close())
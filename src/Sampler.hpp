@@ -1,5 +1,11 @@
 #pragma once
 
+#include <bit>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "common.hpp"
@@ -12,13 +18,14 @@ enum class SampleType : u8
 {
     Random,
     MultiJittered,
+    Sobol,  // Owen-scrambled Sobol, generated on the fly with a separate dimension for each `get` of a path
 };
 
 template<SampleType sample> struct _SampleGenerator;
-// _SampleGenerator<...>::generate_at(vec2g * samples, u32 n);
+// _SampleGenerator<...>::generate_at(vec2g * samples, u32 n, PCG_XSH_RR_32 & rng);
 
 
-void generate_samples(SampleType sample_type, vec2g * samples, u32 n) noexcept;
+void generate_samples(SampleType sample_type, vec2g * samples, u32 n, PCG_XSH_RR_32 & rng = pcg) noexcept;
 
 class Sampler final
 {
@@ -68,34 +75,168 @@ public:
         return vec3g(stheta * cphi, stheta * sphi, ctheta);
     }
 
+    // two tangents which form a right-handed orthonormal basis with `n`, see "Building an Orthonormal Basis, Revisited"
+    static VEC_CONSTEXPR inline std::tuple<normal3g, normal3g> local_frame(normal3g const& n) noexcept
+    {
+        fg const sign = std::copysign(fg(1), n.z);
+        fg const a = -1 / (sign + n.z);
+        fg const b = n.x * n.y * a;
+        return {vec3g(1 + sign * sqr(n.x) * a, sign * b, -sign * n.x), vec3g(b, sign + sqr(n.y) * a, -n.y)};
+    }
+
+    /******** Owen-scrambled Sobol, see "Practical Hash-based Owen Scrambling" by Brent Burley ********/
+
+    static constexpr inline u32 reverse_bits(u32 x) noexcept
+    {
+        x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+        x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+        x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+        x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+        return (x >> 16) | (x << 16);
+    }
+    static constexpr inline u32 hash(u32 x) noexcept
+    {
+        x ^= x >> 16; x *= 0x7FEB352D;
+        x ^= x >> 15; x *= 0x846CA68B;
+        x ^= x >> 16;
+        return x;
+    }
+    static constexpr inline u32 hash_combine(u32 seed, u32 v) noexcept
+    {
+        return hash(seed ^ (v + 0x9E3779B9 + (seed << 6) + (seed >> 2)));
+    }
+    static constexpr inline u32 nested_uniform_scramble(u32 x, u32 seed) noexcept
+    {
+        x = reverse_bits(x);
+        x += seed;
+        x ^= x * 0x6C50B47C;
+        x ^= x * 0xB82F1E52;
+        x ^= x * 0xC7AFE638;
+        x ^= x * 0x8D22F6E6;
+        return reverse_bits(x);
+    }
+    // the first two dimensions of Sobol sequence, in fixed-point
+    static constexpr inline std::tuple<u32, u32> sobol_2d(u32 index) noexcept
+    {
+        u32 x = reverse_bits(index), y = 0;
+        for (u32 v = u32(1) << 31; index != 0; index >>= 1, v ^= v >> 1)
+        {
+            if (index & 1) { y ^= v; }
+        }
+        return {x, y};
+    }
+    static constexpr inline fg fixed_to_float(u32 x) noexcept
+    {
+        // keep the result less than 1
+        constexpr u32 precision = std::min<u32>(32, std::numeric_limits<fg>::digits);
+        return fg(x >> (32 - precision)) / fg(u64(1) << precision);
+    }
+    /// @param seed should be different for each pixel
+    /// @param index the index of sample in pixel
+    /// @param dimension the index of 2d dimensions in a path
+    static VEC_CONSTEXPR inline vec2g owen_sobol(u32 seed, u32 index, u32 dimension) noexcept
+    {
+        seed = hash_combine(seed, dimension);
+        auto [x, y] = sobol_2d(nested_uniform_scramble(index, seed));
+        x = nested_uniform_scramble(x, hash_combine(seed, 1));
+        y = nested_uniform_scramble(y, hash_combine(seed, 2));
+        return vec2g(fixed_to_float(x), fixed_to_float(y));
+    }
+
+    // counter-based random numbers, the result only depends on inputs
+    static constexpr inline u32 counter_random(u32 seed, u32 index, u32 dimension) noexcept
+    {
+        return pcg_hash(hash_combine(hash_combine(seed, index), dimension));
+    }
+    static VEC_CONSTEXPR inline vec2g counter_random_2d(u32 seed, u32 index, u32 dimension) noexcept
+    {
+        u32 const x = counter_random(seed, index, dimension);
+        return vec2g(fixed_to_float(x), fixed_to_float(pcg_hash(x)));
+    }
+
+    // the seed of pixel from its position on screen
+    static VEC_CONSTEXPR inline u32 seed_of(vec2g const& position) noexcept
+    {
+        using uint_t = std::conditional_t<sizeof(fg) == sizeof(u64), u64, u32>;
+        uint_t const x = std::bit_cast<uint_t>(position.x), y = std::bit_cast<uint_t>(position.y);
+        u32 seed = hash(u32(x) ^ u32(u64(x) >> 32));
+        return hash_combine(seed, u32(y) ^ u32(u64(y) >> 32));
+    }
+
+
+    // the state of current path
+    class PathState final
+    {
+    public:
+
+        u32 seed, index, dimension;
+    };
+
+
+    using Pattern = std::vector<vec2g>;
+    using PatternPtr = std::shared_ptr<Pattern const>;
+
+    // sample tables are generated once for each (type, sets, samples per set) and shared read-only by all threads
+    static PatternPtr shared_pattern(SampleType sample_type, u32 n_sample_sets, u32 n_samples_per_set)
+    {
+        static std::mutex patterns_mutex;
+        static std::map<std::tuple<SampleType, u32, u32>, PatternPtr> patterns;
+
+        std::lock_guard<std::mutex> lock(patterns_mutex);
+        PatternPtr & pattern = patterns[{sample_type, n_sample_sets, n_samples_per_set}];
+        if (pattern == nullptr)
+        {
+            // the same pattern for the same key, so that deterministic renders are reproducible between runs
+            PCG_XSH_RR_32 rng(counter_random(static_cast<u32>(sample_type), n_sample_sets, n_samples_per_set));
+            auto new_pattern = std::make_shared<Pattern>(u64(n_sample_sets) * n_samples_per_set);
+            vec2g * samples = new_pattern->data();
+            for (u32 set_index = 0; set_index < n_sample_sets; set_index++)
+            {
+                generate_samples(sample_type, samples, n_samples_per_set, rng);
+                samples += n_samples_per_set;
+            }
+            pattern = std::move(new_pattern);
+        }
+        return pattern;
+    }
+
 private:
 
+    SampleType _sample_type;
+    bool _deterministic;
     u32 _n_sample_sets, _n_samples_per_set;
     u32 _sample_index, _n_samples;
-    std::vector<vec2g> _samples;
+    PatternPtr _pattern;
+    vec2g const* _samples;
+    PathState _path;
 
 public:
 
     Sampler() noexcept
-    : _n_sample_sets(0), _n_samples_per_set{0}, _sample_index{0}, _n_samples{0}, _samples{} {}
+    : _sample_type{SampleType::Random}, _deterministic{false}, _n_sample_sets(0), _n_samples_per_set{0}, _sample_index{0}, _n_samples{0}
+    , _pattern{nullptr}, _samples{nullptr}, _path{0, 0, 0} {}
 
-    void init(SampleType sample_type, u32 n_sample_sets_, u32 n_samples_per_set_) noexcept
+    // only the first call of each pattern generates samples, each thread starts at a random set of the shared pattern.
+    // if `deterministic_`, samples only depend on the path (pixel, sample index & dimension) instead of the thread
+    void init(SampleType sample_type, u32 n_sample_sets_, u32 n_samples_per_set_, bool deterministic_ = false) noexcept
     {
-        if ((n_sample_sets_ != _n_sample_sets) || (n_samples_per_set_ != _n_samples_per_set))
+        _sample_type = sample_type;
+        _deterministic = deterministic_;
+        if (sample_type == SampleType::Sobol)
         {
-            _n_sample_sets = n_sample_sets_;
-            _n_samples_per_set = n_samples_per_set_;
-            _sample_index = 0;
-            _n_samples = n_sample_sets_ * n_samples_per_set_;
-            _samples.resize(_n_samples);
+            // no table is needed
+            _n_sample_sets = _n_samples_per_set = _n_samples = _sample_index = 0;
+            _pattern = nullptr;
+            _samples = nullptr;
+            return;
         }
 
-        vec2g * samples = _samples.data();
-        for (u32 set_index = 0; set_index < _n_sample_sets; set_index++)
-        {
-            generate_samples(sample_type, samples, _n_samples_per_set);
-            samples += _n_samples_per_set;
-        }
+        _n_sample_sets = n_sample_sets_;
+        _n_samples_per_set = n_samples_per_set_;
+        _n_samples = n_sample_sets_ * n_samples_per_set_;
+        _pattern = shared_pattern(sample_type, n_sample_sets_, n_samples_per_set_);
+        _samples = _pattern->data();
+        _sample_index = (_n_sample_sets == 0) ? 0 : (pcg.randbits<u32>() % _n_sample_sets) * _n_samples_per_set;
     }
 
     u32 n_sample_set() const noexcept
@@ -110,17 +251,63 @@ public:
     {
         return _n_samples;
     }
-    std::vector<vec2g> const& samples() const noexcept
+    PatternPtr const& samples() const noexcept
+    {
+        return _pattern;
+    }
+
+    SampleType sample_type() const noexcept
+    {
+        return _sample_type;
+    }
+    bool deterministic() const noexcept
     {
-        return _samples;
+        return _deterministic;
     }
 
+    // start a new path, only matters for Sobol & deterministic mode
+    void start(u32 seed, u32 index) noexcept
+    {
+        _path = PathState{seed, index, 0};
+    }
+    PathState const& path() const noexcept
+    {
+        return _path;
+    }
+    void path(PathState const& path_) noexcept
+    {
+        _path = path_;
+    }
+
+    // next sample of the table, or next dimension of the path for Sobol
     vec2g get() noexcept
     {
+        if (_sample_type == SampleType::Sobol) { return owen_sobol(_path.seed, _path.index, _path.dimension++); }
+        if (_deterministic && (_n_samples > 0))
+        {
+            // each dimension of pixel takes a set, the indices beyond a set, e.g. extra rays of adaptive sampling, take other sets
+            u32 const round = _path.index / _n_samples_per_set;
+            u32 const seed = (round == 0) ? _path.seed : hash_combine(_path.seed, round);
+            u32 const set_index = hash_combine(seed, _path.dimension++) % _n_sample_sets;
+            return _samples[set_index * _n_samples_per_set + _path.index % _n_samples_per_set];
+        }
+
         vec2g const& sample = _samples[_sample_index++];
         if (_sample_index >= _n_samples) { _sample_index = 0; }
         return sample;
     }
+
+    // independent random numbers for decisions of path, which are not stratified except for Sobol
+    template<class T> T uniform01() noexcept
+    {
+        if ((_sample_type != SampleType::Sobol) && !_deterministic) { return pcg.uniform01<T>(); }
+
+        vec2g const sample = (_sample_type == SampleType::Sobol)
+            ? owen_sobol(_path.seed, _path.index, _path.dimension++)
+            : counter_random_2d(_path.seed, _path.index, _path.dimension++);
+        if constexpr (std::is_same_v<T, vec2g>) { return sample; }
+        else { return T(sample.x); }
+    }
 };
 
 static thread_local Sampler sampler;
@@ -128,17 +315,25 @@ static thread_local Sampler sampler;
 
 template<> struct _SampleGenerator<SampleType::Random>
 {
-    static void generate_at(vec2g * samples, u32 n) noexcept
+    static void generate_at(vec2g * samples, u32 n, PCG_XSH_RR_32 & rng) noexcept
     {
-        for (; n > 0; n--)
+        constexpr u32 lanes = PCG_XSH_RR_32x8::lanes;
+        PCG_XSH_RR_32x8 batch_rng(rng.randbits<u64>());
+        u32 bits[lanes];
+        for (u32 index = 0; index < n; index += lanes / 2)
         {
-            *(samples++) = pcg.uniform01<vec2g>();
+            batch_rng.get(bits);
+            u32 const stop = std::min(lanes / 2, n - index);
+            for (u32 k = 0; k < stop; k++)
+            {
+                samples[index + k] = vec2g(Sampler::fixed_to_float(bits[2 * k]), Sampler::fixed_to_float(bits[2 * k + 1]));
+            }
         }
     }
 };
 template<> struct _SampleGenerator<SampleType::MultiJittered>
 {
-    static void generate_at(vec2g * samples, u32 n) noexcept
+    static void generate_at(vec2g * samples, u32 n, PCG_XSH_RR_32 & rng) noexcept
     {
         if (n == 0) { return; }
 
@@ -147,12 +342,21 @@ template<> struct _SampleGenerator<SampleType::MultiJittered>
 
         fg cell_size = 1 / fg(side_len);
 
+        // all random bits are generated in batch, 2 for jittering and 2 for shuffling of each sample
+        PCG_XSH_RR_32x8 batch_rng(rng.randbits<u64>());
+        std::vector<u32> bits(4 * _n);
+        batch_rng.randbits(bits.data(), bits.size());
+        u32 const* jitter_bits = bits.data();
+        u32 const* shuffle_bits = jitter_bits + 2 * _n;
+
         // generate samples
         for (u32 y = 0; y < side_len; y++)
         {
             for (u32 x = 0; x < side_len; x++)
             {
-                samples[y * side_len + x] = ((vec2g(y, x) + pcg.uniform01<vec2g>()) * cell_size + vec2g(x, y)) * cell_size;
+                vec2g jitter(Sampler::fixed_to_float(jitter_bits[0]), Sampler::fixed_to_float(jitter_bits[1]));
+                jitter_bits += 2;
+                samples[y * side_len + x] = ((vec2g(y, x) + jitter) * cell_size + vec2g(x, y)) * cell_size;
             }
         }
         //shuffle x
@@ -160,7 +364,7 @@ template<> struct _SampleGenerator<SampleType::MultiJittered>
         {
             for (u32 x = 0; x < side_len; x++)
             {
-                u32 k = pcg.randbits<u32>() % (side_len - y);
+                u32 k = *(shuffle_bits++) % (side_len - y);
                 std::swap(samples[y * side_len + x].x, samples[k * side_len + x].x);
             }
         }
@@ -169,24 +373,24 @@ template<> struct _SampleGenerator<SampleType::MultiJittered>
         {
             for (u32 y = 0; y < side_len; y++)
             {
-                u32 k = pcg.randbits<u32>() % (side_len - x);
+                u32 k = *(shuffle_bits++) % (side_len - x);
                 std::swap(samples[y * side_len + x].x, samples[y * side_len + k].x);
             }
         }
 
         // generate the rests
-        generate_at(samples + _n, n - _n);
+        generate_at(samples + _n, n - _n, rng);
     }
 };
 
-void inline generate_samples(SampleType sample_type, vec2g * samples, u32 n) noexcept
+void inline generate_samples(SampleType sample_type, vec2g * samples, u32 n, PCG_XSH_RR_32 & rng) noexcept
 {
     switch (sample_type)
     {
     case SampleType::MultiJittered:
-        return _SampleGenerator<SampleType::MultiJittered>::generate_at(samples, n);
+        return _SampleGenerator<SampleType::MultiJittered>::generate_at(samples, n, rng);
     default:
-        return _SampleGenerator<SampleType::Random>::generate_at(samples, n);
+        return _SampleGenerator<SampleType::Random>::generate_at(samples, n, rng);
     }
 }
 
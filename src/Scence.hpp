@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
+#include <numeric>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 #include "common.hpp"
+#include "components/Instance.hpp"
 #include "components/Object3D.hpp"
+#include "components/StaticDispatch.hpp"
+#include "geometry/BoundingBox.hpp"
 #include "geometry/Ray.hpp"
 #include "components/cameras/Camera.hpp"
 #include "components/sky_models/Sky.hpp"
@@ -24,23 +30,168 @@ public:
 
 protected:
 
+    // node of the top-level bounding volume hierarchy over objects, same as `Mesh::BoxNode`
+    class ObjectNode
+    {
+    public:
+
+        BoundingBox box;
+        u32 index_l; // the index to left child node or to `_object_indices` if is leaf
+        u32 index_r; // the index to right child node or the length of objects if is leaf, and the highest bit indicate this is leaf or not
+
+        static constexpr u32 leafbit = 0x80000000;
+
+        VEC_CONSTEXPR ObjectNode() noexcept
+        : box{}, index_l{0}, index_r{0} {}
+        VEC_CONSTEXPR ObjectNode(BoundingBox const* boxes, u32 const* object_indices, u32 start, u32 n_objects) noexcept
+        : box{}, index_l{start}, index_r{n_objects | leafbit} {
+            for (u32 index = start; index < start + n_objects; index++) { box.bound(boxes[object_indices[index]]); }
+        }
+
+        constexpr bool isleaf() const noexcept
+        {
+            return (index_r & leafbit) != 0;
+        }
+
+        constexpr u32 leftchild() const noexcept
+        {
+            return index_l;
+        }
+        constexpr u32 rightchild() const noexcept
+        {
+            return index_r;
+        }
+        constexpr u32 objects_start() const noexcept
+        {
+            return index_l;
+        }
+        constexpr u32 objects_length() const noexcept
+        {
+            return index_r & (~leafbit);
+        }
+    };
+
+    static constexpr u32 max_objects_per_node = 2;
+    static constexpr u32 max_nodes_depth = 32;
+
+
     bool _prepared;
     CameraPtr _camera_p;
     SkyPtr _sky_p;
+    std::vector<LightSourceDispatch> _light_ds;
+
+    std::vector<ObjectNode> _object_nodes;
+    std::vector<u32> _object_indices;   // indices less than `objects.size()` are objects, the others are instances
+
+    bool _trace_object(u32 index, Ray const& ray, TraceRecord & rec) const noexcept
+    {
+        if (index < objects.size()) { return objects[index].trace(ray, rec); }
+        Instance const& instance = instances[index - objects.size()];
+        return instance.trace(prototypes[instance.prototype], ray, rec);
+    }
+    bool _test_hit_object(u32 index, Ray const& ray, fg max_ray_time) const noexcept
+    {
+        if (index < objects.size()) { return objects[index].test_hit(ray, max_ray_time); }
+        Instance const& instance = instances[index - objects.size()];
+        return instance.test_hit(prototypes[instance.prototype], ray, max_ray_time);
+    }
+
+    // divide objects at the median of their centers on the longest axis
+    void _build_objects_hierarchy()
+    {
+        u64 const n_objects = objects.size() + instances.size();
+        std::vector<BoundingBox> boxes;
+        std::vector<vec3g> centers;
+        boxes.reserve(n_objects);
+        centers.reserve(n_objects);
+        for (Object3D const& object : objects)
+        {
+            boxes.emplace_back(object.bounding_box());
+        }
+        std::vector<BoundingBox> prototype_boxes;
+        prototype_boxes.reserve(prototypes.size());
+        for (Object3D const& prototype : prototypes)
+        {
+            prototype_boxes.emplace_back(prototype.mesh_p->bounding_box());
+        }
+        for (Instance const& instance : instances)
+        {
+            boxes.emplace_back(instance.bounding_box(prototype_boxes[instance.prototype]));
+        }
+        for (BoundingBox const& box : boxes)
+        {
+            centers.emplace_back(box.empty() ? consts<vec3g>::O : consts<fg>::half * (box.min_corner + box.max_corner));
+        }
+
+        _object_indices.resize(n_objects);
+        std::iota(_object_indices.begin(), _object_indices.end(), 0);
+
+        _object_nodes.clear();
+        std::vector<u32> nodes_depth;
+        // global node
+        _object_nodes.emplace_back(boxes.data(), _object_indices.data(), 0, n_objects);
+        nodes_depth.emplace_back(1);
+
+        u32 node_index = 0, node_count = 1;
+        for (; node_index < node_count; node_index++)
+        {
+            ObjectNode & node = _object_nodes[node_index];
+            u32 node_depth = nodes_depth[node_index];
+            if ((node.objects_length() <= max_objects_per_node) || (node_depth >= max_nodes_depth)) { continue; }
+
+            u32 start = node.objects_start();
+            u32 stop = start + node.objects_length();
+
+            BoundingBox centers_box;
+            for (u32 index = start; index < stop; index++) { centers_box.bound(centers[_object_indices[index]]); }
+            vec3g const centers_size = centers_box.size();
+            u32 axis = (centers_size.x > centers_size.y) ? 0 : 1;
+            if (centers_size.z > centers_size[axis]) { axis = 2; }
+            if (centers_size[axis] < consts<fg>::eps) { continue; }     // all objects are at the same place
+
+            u32 middle = (start + stop) / 2;
+            std::nth_element(_object_indices.begin() + start, _object_indices.begin() + middle, _object_indices.begin() + stop,
+                [&centers, axis] (u32 l, u32 r) noexcept -> bool
+            {
+                return centers[l][axis] < centers[r][axis];
+            });
+
+            // contruct child-nodes
+            node.index_l = node_count++;
+            node.index_r = node_count++;
+            nodes_depth.emplace_back(node_depth + 1);
+            nodes_depth.emplace_back(node_depth + 1);
+            _object_nodes.emplace_back(boxes.data(), _object_indices.data(), start, middle - start);
+            _object_nodes.emplace_back(boxes.data(), _object_indices.data(), middle, stop - middle);
+        }
+    }
 
     bool _prepare()
     {
         if (!has_camera() || (!_camera_p->prepare())) { return false; }
         if (has_sky() && (!_sky_p->prepare())) { return false; }
 
+        _light_ds.clear();
         for (LightSourcePtr & light_p : light_ps)
         {
             if (!light_p->prepare()) { return false; }
+            _light_ds.emplace_back(light_p.get());
         }
         for (Object3D & object : objects)
         {
             if (!object.prepare()) { return false; }
         }
+        // shared meshes are prepared only once, as `Mesh::prepare` does nothing if it is already prepared
+        for (Object3D & prototype : prototypes)
+        {
+            if (!prototype.prepare()) { return false; }
+        }
+        for (Instance const& instance : instances)
+        {
+            if (instance.prototype >= prototypes.size()) { return false; }
+        }
+
+        _build_objects_hierarchy();
         return true;
     }
 
@@ -48,6 +199,8 @@ public:
 
     std::vector<LightSourcePtr> light_ps;
     std::vector<Object3D> objects;
+    std::vector<Object3D> prototypes;   // objects only placed by `instances`, they are not traced by themself
+    std::vector<Instance> instances;
 
     Scence() noexcept
     : _prepared(false), _camera_p{nullptr}, _sky_p{nullptr} {}
@@ -107,23 +260,98 @@ public:
     {
         return *_sky_p;
     }
+    // the light sources for rendering, only valid after prepared
+    std::vector<LightSourceDispatch> const& light_dispatches() const noexcept
+    {
+        return _light_ds;
+    }
 
 
     bool trace(Ray const& ray, TraceRecord & rec) const noexcept
     {
+        if (_object_nodes.empty()) { return false; }
+
+        auto [time_in, time_out] = _object_nodes.front().box.trace(ray);
+        if (!BoundingBox::intersect(time_in, time_out, rec.max_ray_time)) { return false; }
+
+        using StackEltype = std::tuple<ObjectNode const* /* node */, fg /* time_in */>;
+        StackEltype to_trace_nodes[max_nodes_depth + 1];
+        StackEltype * node_p = to_trace_nodes;
+        *node_p = {&_object_nodes.front(), time_in};
+
         bool hit = false;
-        for (Object3D const& object : objects)
+        while (node_p >= to_trace_nodes)
         {
-            hit |= object.trace(ray, rec);
+            ObjectNode const& node = *std::get<0>(*node_p);
+            time_in = std::get<1>(*(node_p--));
+
+            if (time_in >= rec.max_ray_time) { continue; }
+
+            if (node.isleaf())
+            {
+                u32 stop = node.objects_start() + node.objects_length();
+                for (u32 index = node.objects_start(); index < stop; index++)
+                {
+                    hit |= _trace_object(_object_indices[index], ray, rec);
+                }
+            }
+            else
+            {
+                // trace two chidren nodes
+                ObjectNode const* child_l = &_object_nodes[node.leftchild()];
+                ObjectNode const* child_r = &_object_nodes[node.rightchild()];
+                auto [in_l, out_l] = child_l->box.trace(ray);
+                auto [in_r, out_r] = child_r->box.trace(ray);
+
+                // sort them so that the first hit is the left one
+                if (in_r < in_l)
+                {
+                    std::swap(child_l, child_r);
+                    std::swap(in_l, in_r);
+                    std::swap(out_l, out_r);
+                }
+
+                // push them in to stack (or not)
+                if (BoundingBox::intersect(in_r, out_r, rec.max_ray_time))
+                {
+                    *(++node_p) = {child_r, in_r};
+                }
+                if (BoundingBox::intersect(in_l, out_l, rec.max_ray_time))
+                {
+                    *(++node_p) = {child_l, in_l};
+                }
+            }
         }
         return hit;
     }
 
     bool test_hit(Ray const& ray, fg max_ray_time) const noexcept
     {
-        for (Object3D const& object : objects)
+        if (_object_nodes.empty()) { return false; }
+
+        ObjectNode const* to_trace_nodes[max_nodes_depth + 1];
+        ObjectNode const** node_p = to_trace_nodes;
+        *node_p = &_object_nodes.front();
+
+        while (node_p >= to_trace_nodes)
         {
-            if (object.test_hit(ray, max_ray_time)) { return true; }
+            ObjectNode const& node = **(node_p--);
+            auto [time_in, time_out] = node.box.trace(ray);
+            if (!BoundingBox::intersect(time_in, time_out, max_ray_time)) { continue; }
+
+            if (node.isleaf())
+            {
+                u32 stop = node.objects_start() + node.objects_length();
+                for (u32 index = node.objects_start(); index < stop; index++)
+                {
+                    if (_test_hit_object(_object_indices[index], ray, max_ray_time)) { return true; }
+                }
+            }
+            else
+            {
+                *(++node_p) = &_object_nodes[node.rightchild()];
+                *(++node_p) = &_object_nodes[node.leftchild()];
+            }
         }
         return false;
     }
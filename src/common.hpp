@@ -1,11 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <inttypes.h>
 #include <math.h>
 #include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 #include "../third-party/glm/glm.hpp"
 
@@ -366,4 +370,31 @@ inline f32 timeit(std::function<void()> const& func) noexcept
     return milis / 1000;
 }
 
+
+/********** parallel **********/
+
+// call `func(index)` for each index in [0,n) on `n_threads` threads (including the calling one),
+// indices are taken in order but the order of finishing is not guaranteed.
+inline void parallel_for(u32 n_threads, u64 n, std::function<void(u64)> const& func)
+{
+    n_threads = static_cast<u32>(std::min<u64>(n_threads, n));
+    if (n_threads <= 1)
+    {
+        for (u64 index = 0; index < n; index++) { func(index); }
+        return;
+    }
+
+    std::atomic<u64> next_index{0};
+    auto work = [&] ()
+    {
+        for (u64 index; (index = next_index.fetch_add(1, std::memory_order_relaxed)) < n;) { func(index); }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_threads - 1);
+    for (u32 k = 1; k < n_threads; k++) { threads.emplace_back(work); }
+    work();
+    for (std::thread & thread : threads) { thread.join(); }
+}
+
 } // namespace nyasRT
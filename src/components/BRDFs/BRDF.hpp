@@ -33,7 +33,14 @@ public:
         else { outgoing = rec.hit_normal; }
 
         //if (dot(outgoing, rec.face_normal) < 0) { outgoing = reflect(outgoing, rec.face_normal); }
-        return {outgoing, (*this)(base_color, -ray.direction, outgoing, rec.hit_normal)};
+        // `brdf * cosθ / pdf` where `pdf = cosθ / π`
+        return {outgoing, consts<f32>::pi * (*this)(base_color, outgoing, -ray.direction, rec.hit_normal)};
+    }
+
+    // the probability density in solid angle of `bounds` choosing `incoming` as the light direction when viewed from `outgoing`
+    virtual VEC_CONSTEXPR f32 pdf(normal3g const& incoming, normal3g const& outgoing, normal3g const& normal) const noexcept
+    {
+        return std::max(0.0f, f32(dot(incoming, normal))) * consts<f32>::inv_pi;
     }
 
     virtual VEC_CONSTEXPR RGB emitted(RGB const& base_color, Ray const& ray, TraceRecord const& rec) const noexcept
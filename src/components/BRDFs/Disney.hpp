@@ -2,6 +2,7 @@
 
 #include <math.h>
 
+#include "../../Sampler.hpp"
 #include "BRDF.hpp"
 
 
@@ -37,6 +38,39 @@ private:
         return 1.0f / (v_dot_n + std::sqrt(aa + vv - aa * vv));
     }
 
+    // sample the GGX distribution of normals visible from `view` in local frame, see "Sampling the GGX Distribution of Visible Normals"
+    static VEC_CONSTEXPR inline vec3g sample_ggx_vndf(vec3g const& view, fg a, vec2g const& uv) noexcept
+    {
+        using glm::normalize;
+        vec3g const vh = normalize(vec3g(a * view.x, a * view.y, view.z));
+        fg const lensq = sqr(vh.x) + sqr(vh.y);
+        vec3g const t1 = (lensq > 0) ? vec3g(-vh.y, vh.x, 0) / std::sqrt(lensq) : consts<vec3g>::X;
+        vec3g const t2 = cross(vh, t1);
+
+        fg const r = std::sqrt(uv.x), phi = consts<fg>::two_pi * uv.y;
+        fg const p1 = r * std::cos(phi);
+        fg const s = consts<fg>::half * (1 + vh.z);
+        fg const p2 = (1 - s) * std::sqrt(1 - sqr(p1)) + s * r * std::sin(phi);
+        vec3g const nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(fg(0), 1 - sqr(p1) - sqr(p2))) * vh;
+        return normalize(vec3g(a * nh.x, a * nh.y, std::max(fg(0), nh.z)));
+    }
+    // sample the GTR1 distribution of normals in local frame
+    static VEC_CONSTEXPR inline vec3g sample_gtr1(fg a, vec2g const& uv) noexcept
+    {
+        fg const aa = sqr(a);
+        fg const ctheta = std::sqrt(std::max(fg(0), (1 - std::pow(aa, 1 - uv.x)) / (1 - aa)));
+        fg const stheta = std::sqrt(std::max(fg(0), 1 - sqr(ctheta)));
+        fg const phi = consts<fg>::two_pi * uv.y;
+        return vec3g(stheta * std::cos(phi), stheta * std::sin(phi), ctheta);
+    }
+
+    // the probabilities of choosing diffuse, specular & clearcoat lobe in `bounds`
+    VEC_CONSTEXPR vec3g lobe_weights() const noexcept
+    {
+        vec3g const weights = vec3g(1.0f - _metalic, 1.0f, 0.25f * _clearcoat);
+        return weights / (weights.x + weights.y + weights.z);
+    }
+
 
     f32 _subsurface, _metalic, _specular, _specular_tint, _roughness, _sheen, _sheen_tint, _clearcoat, _clearcoat_gloss;
 
@@ -172,6 +206,62 @@ public:
             + gs * ds * fs
             + 0.25f * _clearcoat * gr * fr * dr;
     }
+
+    virtual VEC_CONSTEXPR f32 pdf(normal3g const& incoming, normal3g const& outgoing, normal3g const& normal) const noexcept override
+    {
+        using glm::normalize;
+        f32 i_dot_n = dot(incoming, normal), o_dot_n = dot(outgoing, normal);
+        if ((i_dot_n <= 0) || (o_dot_n <= 0)) { return 0; }
+        vec3g half_vec = normalize(incoming + outgoing);
+        f32 h_dot_n = dot(half_vec, normal), o_dot_h = dot(outgoing, half_vec);
+        if (o_dot_h <= 0) { return 0; }
+
+        vec3g const weights = lobe_weights();
+        f32 alpha = sqr(_roughness);
+        f32 pdf_diffuse = consts<f32>::inv_pi * i_dot_n;
+        f32 pdf_specular = 0.5f * D_gtr2(h_dot_n, alpha) * smith_ggx(o_dot_n, alpha);
+        f32 a_clearcoat = lerp(0.1f, 0.001f, _clearcoat_gloss);
+        f32 pdf_clearcoat = D_gtr1(h_dot_n, a_clearcoat) * h_dot_n / (4.0f * o_dot_h);
+        return weights.x * pdf_diffuse + weights.y * pdf_specular + weights.z * pdf_clearcoat;
+    }
+
+    // choose a lobe and importance sample it, the returned weight is `brdf * cosθ / pdf` where pdf is the combined one of all lobes
+    virtual VEC_CONSTEXPR std::tuple<normal3g, RGB> bounds(RGB const& base_color, Ray const& ray, TraceRecord const& rec) const noexcept override
+    {
+        using glm::reflect;
+        if (dot(ray.direction, rec.face_normal) > 0) // ray hit surface from behind
+        {
+            return {ray.direction, consts<RGB>::White};   // surface cannot be seen from behind
+        }
+
+        normal3g const& normal = rec.hit_normal;
+        normal3g const view = -ray.direction;
+        auto const [tangent, bitangent] = Sampler::local_frame(normal);
+        vec3g const local_view = vec3g(dot(view, tangent), dot(view, bitangent), dot(view, normal));
+        if (local_view.z <= 0) { return {reflect(ray.direction, normal), consts<RGB>::Black}; }
+
+        vec3g const weights = lobe_weights();
+        f32 const lobe = sampler.uniform01<f32>();
+        vec2g const uv = sampler.get();
+
+        vec3g local_light;
+        if (lobe < weights.x)
+        {
+            local_light = Sampler::hemisphere(uv);
+        }
+        else
+        {
+            vec3g const local_half = (lobe < weights.x + weights.y) ? sample_ggx_vndf(local_view, sqr(_roughness), uv)
+                : sample_gtr1(lerp(0.1f, 0.001f, _clearcoat_gloss), uv);
+            local_light = reflect(-local_view, local_half);
+        }
+        if (local_light.z <= 0) { return {reflect(ray.direction, normal), consts<RGB>::Black}; }
+
+        normal3g const light = local_light.x * tangent + local_light.y * bitangent + local_light.z * normal;
+        f32 const p = pdf(light, view, normal);
+        if (!(p > 0)) { return {light, consts<RGB>::Black}; }
+        return {light, (*this)(base_color, light, view, normal) * (f32(local_light.z) / p)};
+    }
 };
 
 } // namespace BRDFs
@@ -63,7 +63,7 @@ public:
         normal3g outgoing = Sampler::sphere(sampler.get());
         RGB surface_color = consts<RGB>::White;
 
-        if (pcg.uniform01<f32>() > _clearcoat)
+        if (sampler.uniform01<f32>() > _clearcoat)
         {
             normal3g prefect_reflection = reflect(ray.direction, rec.hit_normal);
             outgoing = normalize(lerp(prefect_reflection, outgoing, fg(_roughness)));
@@ -85,7 +85,12 @@ public:
         // yeah, this BRDF model produces incorrect specular shape.
 
         RGB reflected_color = lerp(base_color, consts<RGB>::White, _clearcoat);
-        f32 pdf = 0;
+        return pdf(incoming, outgoing, normal) * reflected_color;
+    }
+
+    virtual VEC_CONSTEXPR f32 pdf(normal3g const& incoming, normal3g const& outgoing, normal3g const& normal) const noexcept override
+    {
+        f32 density = 0;
 
         normal3g prefect_reflection = -reflect(outgoing, normal);
         vec3g C = fg(1 - _roughness) * prefect_reflection;
@@ -101,8 +106,8 @@ public:
             if (d2 < r2)
             {
                 fg s = std::sqrt(r2 - d2);
-                pdf += r_pdf_sphere * sqr(t + s) / s;
-                if (fg tmp = t - s; tmp > 0) { pdf += r_pdf_sphere * sqr(tmp) / s; }
+                density += r_pdf_sphere * sqr(t + s) / s;
+                if (fg tmp = t - s; tmp > 0) { density += r_pdf_sphere * sqr(tmp) / s; }
             }
         }
         // the probability density of light being reflected back to the upper hemisphere
@@ -114,13 +119,12 @@ public:
             if (d2 < r2)
             {
                 fg s = std::sqrt(r2 - d2);
-                pdf += r_pdf_sphere * sqr(t + s) / s;
-                if (fg tmp = t - s; tmp > 0) { pdf += r_pdf_sphere * sqr(tmp) / s; }
+                density += r_pdf_sphere * sqr(t + s) / s;
+                if (fg tmp = t - s; tmp > 0) { density += r_pdf_sphere * sqr(tmp) / s; }
             }
         }
 
-        pdf = lerp(pdf, consts<f32>::inv_pi, _clearcoat);
-        return pdf * reflected_color;
+        return lerp(density, consts<f32>::inv_pi, _clearcoat);
     }
 };
 
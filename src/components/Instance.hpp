@@ -0,0 +1,80 @@
+#pragma once
+
+#include "../common.hpp"
+#include "../geometry/BoundingBox.hpp"
+#include "../geometry/Ray.hpp"
+#include "../geometry/Transform.hpp"
+#include "Object3D.hpp"
+
+
+namespace nyasRT
+{
+// a placement of a prototype object, which shares the mesh, material and brdf of the prototype.
+// only the inversed matrix and the prototype index are stored, so that millions of instances can be placed.
+// note that the transform of prototype is not applied on instances.
+class Instance final
+{
+public:
+
+    Affine world_to_model;
+    u32 prototype;  // the index to `Scence::prototypes`
+
+    VEC_CONSTEXPR Instance() noexcept
+    : world_to_model{}, prototype{0} {}
+    VEC_CONSTEXPR Instance(Affine const& model_to_world, u32 prototype_) noexcept
+    : world_to_model{model_to_world.inverse()}, prototype{prototype_} {}
+    VEC_CONSTEXPR Instance(Transform const& transform, u32 prototype_) noexcept
+    : Instance(transform.matrix(), prototype_) {}
+
+    VEC_CONSTEXPR Affine model_to_world() const noexcept
+    {
+        return world_to_model.inverse();
+    }
+
+    // the bounding box in world space from the bounding box of prototype mesh in model space
+    VEC_CONSTEXPR BoundingBox bounding_box(BoundingBox const& model_box) const noexcept
+    {
+        if (model_box.empty()) { return model_box; }
+
+        Affine const matrix = model_to_world();
+        BoundingBox box;
+        for (u32 k = 0; k < 8; k++)
+        {
+            vec3g corner;
+            corner.x = (k & 1) ? model_box.max_corner.x : model_box.min_corner.x;
+            corner.y = (k & 2) ? model_box.max_corner.y : model_box.min_corner.y;
+            corner.z = (k & 4) ? model_box.max_corner.z : model_box.min_corner.z;
+            box.bound(matrix.apply_point(corner));
+        }
+        box.prepare();
+        return box;
+    }
+
+
+    // the ray time in model space is the same as in world space, since the ray direction is not re-normalized
+    bool trace(Object3D const& prototype_, Ray const& ray, TraceRecord & rec) const noexcept
+    {
+        Ray model_ray = world_to_model.apply(ray);
+        if (prototype_.mesh_p->trace(model_ray, rec))
+        {
+            rec.hit_point = ray.at(rec.max_ray_time);
+            // areas are scaled by `|det| * |transposed inverse * normal|`, same as `Object3D::trace`
+            vec3g const face_normal = world_to_model.apply_transposed(rec.face_normal);
+            fg const area_scale = length(face_normal) / std::abs(world_to_model.determinant());
+            rec.face_normal = face_normal / length(face_normal);
+            rec.hit_normal = normalize(world_to_model.apply_transposed(rec.hit_normal));
+            rec.hit_texture_scale /= std::sqrt(area_scale);
+            rec.object_p = &prototype_;
+            return true;
+        }
+        return false;
+    }
+
+    bool test_hit(Object3D const& prototype_, Ray const& ray, fg max_ray_time) const noexcept
+    {
+        Ray model_ray = world_to_model.apply(ray);
+        return prototype_.mesh_p->test_hit(model_ray, max_ray_time);
+    }
+};
+
+} // namespace nyasRT
@@ -3,11 +3,13 @@
 #include <memory>
 
 #include "../common.hpp"
+#include "../geometry/BoundingBox.hpp"
 #include "../geometry/Ray.hpp"
 #include "../geometry/Mesh.hpp"
 #include "../geometry/Transform.hpp"
 #include "BRDFs/BRDF.hpp"
 #include "materials/Material.hpp"
+#include "StaticDispatch.hpp"
 
 
 namespace nyasRT
@@ -25,6 +27,10 @@ public:
     MaterialPtr material_p;
     BRDFPtr brdf_p;
 
+    // the material & brdf for rendering, only valid after prepared
+    MaterialDispatch material_d;
+    BRDFDispatch brdf_d;
+
     Object3D() noexcept
     : mesh_p{nullptr}, transform{}, material_p{nullptr}, brdf_p{nullptr} {}
     Object3D(MeshPtr mesh, MaterialPtr material, BRDFPtr brdf) noexcept
@@ -34,18 +40,47 @@ public:
     bool prepare()
     {
         if ((mesh_p == nullptr) || (material_p == nullptr) || (brdf_p == nullptr)) { return false; }
-        return mesh_p->prepare() && material_p->prepare() && brdf_p->prepare();
+        if (!(transform.prepare() && mesh_p->prepare() && material_p->prepare() && brdf_p->prepare())) { return false; }
+
+        material_d = MaterialDispatch(material_p.get());
+        brdf_d = BRDFDispatch(brdf_p.get());
+        return true;
+    }
+
+
+    // the bounding box in world space, only valid after prepared
+    BoundingBox bounding_box() const noexcept
+    {
+        BoundingBox const model_box = mesh_p->bounding_box();
+        if (model_box.empty()) { return model_box; }
+
+        BoundingBox box;
+        for (u32 k = 0; k < 8; k++)
+        {
+            vec3g corner;
+            corner.x = (k & 1) ? model_box.max_corner.x : model_box.min_corner.x;
+            corner.y = (k & 2) ? model_box.max_corner.y : model_box.min_corner.y;
+            corner.z = (k & 4) ? model_box.max_corner.z : model_box.min_corner.z;
+            box.bound(transform.model_to_world.apply_point(corner));
+        }
+        box.prepare();
+        return box;
     }
 
 
+    // the ray time in model space is the same as in world space, since the ray direction is not re-normalized
     bool trace(Ray const& ray, TraceRecord & rec) const noexcept
     {
-        Ray model_ray = transform.undo(ray);
+        Ray model_ray = transform.world_to_model.apply(ray);
         if (mesh_p->trace(model_ray, rec))
         {
-            rec.hit_point = transform.apply_point(rec.hit_point);
-            rec.face_normal = transform.apply_normal(rec.face_normal);
-            rec.hit_normal = transform.apply_normal(rec.hit_normal);
+            rec.hit_point = ray.at(rec.max_ray_time);
+            // areas are scaled by `|det| * |transposed inverse * normal|`
+            vec3g const face_normal = transform.normal_matrix.apply_vector(rec.face_normal);
+            fg const area_scale = length(face_normal) * std::abs(transform.model_to_world.determinant());
+            rec.face_normal = face_normal / length(face_normal);
+            rec.hit_normal = transform.normal_matrix.apply_vector(rec.hit_normal);
+            rec.hit_texture_scale /= std::sqrt(area_scale);
             rec.object_p = this;
             return true;
         }
@@ -54,7 +89,7 @@ public:
 
     bool test_hit(Ray const& ray, fg max_ray_time) const noexcept
     {
-        Ray model_ray = transform.undo(ray);
+        Ray model_ray = transform.world_to_model.apply(ray);
         return mesh_p->test_hit(model_ray, max_ray_time);
     }
 };
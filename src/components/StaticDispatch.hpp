@@ -0,0 +1,66 @@
+#pragma once
+
+#include <typeinfo>
+#include <variant>
+
+#include "../common.hpp"
+#include "BRDFs/BRDF.hpp"
+#include "BRDFs/Disney.hpp"
+#include "BRDFs/SimplyWrongSpecular.hpp"
+#include "light_sources/LightSource.hpp"
+#include "light_sources/SunLight.hpp"
+#include "materials/Material.hpp"
+#include "materials/FunctionalMaterial.hpp"
+#include "materials/PureColor.hpp"
+#include "materials/Texture.hpp"
+
+
+namespace nyasRT
+{
+// a pointer to `Base` which remembers the exact type of pointee if it is one of the built-in `Types`,
+// so that the kernels visiting it are instantiated for the exact type, where the compiler can devirtualize the calls.
+// other types, including the ones derived from built-in types, fall back to virtual calls through `Base`.
+// only enabled with `NYASRT_STATIC_DISPATCH`, otherwise it always holds a `Base` pointer
+template<class Base, class... Types> class StaticDispatch final
+{
+public:
+
+#if defined(NYASRT_STATIC_DISPATCH)
+    using Pointer = std::variant<Base const*, Types const*...>;
+#else
+    using Pointer = std::variant<Base const*>;
+#endif
+
+    Pointer pointer;
+
+    StaticDispatch() noexcept
+    : pointer{static_cast<Base const*>(nullptr)} {}
+    explicit StaticDispatch(Base const* p) noexcept
+    : pointer{p}
+    {
+#if defined(NYASRT_STATIC_DISPATCH)
+        if (p != nullptr) { (_match<Types>(p) || ...); }
+#endif
+    }
+
+    // call `function` with the pointee as its exact type
+    template<class Function> decltype(auto) visit(Function && function) const
+    {
+        return std::visit([&function] (auto const* p) -> decltype(auto) { return function(*p); }, pointer);
+    }
+
+private:
+
+    template<class Type> bool _match(Base const* p) noexcept
+    {
+        if (typeid(*p) != typeid(Type)) { return false; }
+        pointer = static_cast<Type const*>(p);
+        return true;
+    }
+};
+
+using MaterialDispatch = StaticDispatch<materials::Material, materials::PureColor, materials::FunctionalMaterial, materials::Texture>;
+using BRDFDispatch = StaticDispatch<BRDFs::BRDF, BRDFs::DisneyBRDF, BRDFs::SimplyWrongSpecular>;
+using LightSourceDispatch = StaticDispatch<light_sources::LightSource, light_sources::SunLight>;
+
+} // namespace nyasRT
@@ -18,6 +18,12 @@ public:
     }
 
     virtual Ray cast_ray(vec2g const& screen_position /* in [-1,1] */) const noexcept = 0;
+
+    // the spread angle of ray cones through pixels of `pixel_size` on screen, 0 to disable texture filtering
+    virtual fg spread_angle(vec2g const& pixel_size) const noexcept
+    {
+        return 0;
+    }
 };
 
 } // namespace cameras
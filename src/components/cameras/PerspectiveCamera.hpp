@@ -31,6 +31,12 @@ public:
         return Ray(_view.origin, normalize(direction));
     }
 
+    // the angle subtended by a pixel at screen center
+    virtual fg spread_angle(vec2g const& pixel_size) const noexcept override
+    {
+        return std::min(pixel_size.x * length(_horizontal), pixel_size.y * length(_vertical)) / length(_view.direction);
+    }
+
 
     // can be used in `view_direction(view_direction, view_up)`
     static VEC_CONSTEXPR vec3g choose_view_up(vec3g const& view_direction_) noexcept
@@ -21,9 +21,14 @@ public:
 
     virtual bool test_hit(Ray const& ray, fg max_ray_time) const noexcept = 0;
 
+    // the light carried by a ray from `sample` divided by the density of `sample`,
+    // so the radiance along the ray is `light(ray) * pdf(ray.origin, ray.direction)`
     virtual RGB light(Ray const& ray) const noexcept = 0;
 
     virtual std::tuple<normal3g, fg> sample(vec3g const& point) const noexcept = 0;
+
+    // the probability density in solid angle of `sample` choosing `direction` at `point`
+    virtual fg pdf(vec3g const& point, normal3g const& direction) const noexcept = 0;
 };
 
 } // namespace light_sources
@@ -119,10 +119,17 @@ public:
 
     virtual VEC_CONSTEXPR std::tuple<normal3g, fg> sample(vec3g const& point) const noexcept override
     {
-        vec2g pos = Sampler::disk(pcg.uniform01<vec2g>());
+        vec2g pos = Sampler::disk(sampler.uniform01<vec2g>());
         normal3g direction = normalize(_solar_direction + pos.x * _u + pos.y * _v);
         return {direction, consts<fg>::inf};
     }
+
+    virtual VEC_CONSTEXPR fg pdf(vec3g const& point, normal3g const& direction) const noexcept override
+    {
+        vec3g const tmp = cross(direction, _solar_direction);
+        if ((dot(direction, _solar_direction) <= 0) || (dot(tmp, tmp) > sqr(solar_radius))) { return 0; }
+        return 1 / solor_solid_angle;
+    }
 };
 
 #if (!GLM_HAS_CONSTEXPR)
@@ -2,10 +2,13 @@
 
 #include <filesystem>
 #include <fstream>
+#include <math.h>
 #include <memory>
+#include <vector>
 
 #include "../../graphics/GraphicsBuffer.hpp"
 #include "../../graphics/Interpolation.hpp"
+#include "../../graphics/TiledImage.hpp"
 #include "Material.hpp"
 
 
@@ -15,25 +18,65 @@ namespace materials
 {
 class Texture : public Material
 {
+protected:
+
+    std::vector<GraphicsBuffer> _mipmaps;   // the level `k + 1` of mip pyramid, built in `prepare`
+
+    // the image of half size, each pixel is the average of 2x2 pixels
+    static GraphicsBuffer _downsample(GraphicsBuffer const& gbuf)
+    {
+        GraphicsBuffer half(glm::max(gbuf.size() / 2u, size2_t(1)));
+        for (u32 y = 0; y < half.height(); y++)
+        {
+            u32 const y0 = std::min(2 * y, gbuf.height() - 1), y1 = std::min(2 * y + 1, gbuf.height() - 1);
+            for (u32 x = 0; x < half.width(); x++)
+            {
+                u32 const x0 = std::min(2 * x, gbuf.width() - 1), x1 = std::min(2 * x + 1, gbuf.width() - 1);
+                half[index2_t(x, y)] = 0.25f * (gbuf[index2_t(x0, y0)] + gbuf[index2_t(x1, y0)] + gbuf[index2_t(x0, y1)] + gbuf[index2_t(x1, y1)]);
+            }
+        }
+        return half;
+    }
+
+    GraphicsBuffer const& _level(u32 level) const noexcept
+    {
+        return (level == 0) ? *gbuf_p : _mipmaps[level - 1];
+    }
+
+    u32 _levels() const noexcept
+    {
+        return (tiled_p != nullptr) ? tiled_p->levels() : (_mipmaps.size() + 1);
+    }
+    RGB _lookup(u32 level, vec2g const& pos) const noexcept
+    {
+        if (tiled_p == nullptr) { return method(_level(level), pos); }
+        return method([this, level] (index2_t index) { return tiled_p->texel(level, index); }, tiled_p->size(level), pos);
+    }
+
 public:
 
     Interpolation method;
     GraphicsBuffer * gbuf_p;
     bool owned_gbuf;  // if true, the gbuf inside will be deleted when this texture destroy.
+    std::shared_ptr<TiledImage> tiled_p;  // if set, the texels are read through tile cache instead of `gbuf_p`
 
     Texture() noexcept
-    : method{Interpolation::Nearest}, gbuf_p{nullptr}, owned_gbuf{false} {}
+    : method{Interpolation::Nearest}, gbuf_p{nullptr}, owned_gbuf{false}, tiled_p{nullptr} {}
     Texture(Interpolation method_, GraphicsBuffer * fig_p, bool owned_fig = false) noexcept
-    : method{method_}, gbuf_p{fig_p}, owned_gbuf{owned_fig} {}
+    : method{method_}, gbuf_p{fig_p}, owned_gbuf{owned_fig}, tiled_p{nullptr} {}
+    Texture(Interpolation method_, std::shared_ptr<TiledImage> tiled) noexcept
+    : method{method_}, gbuf_p{nullptr}, owned_gbuf{false}, tiled_p{tiled} {}
     virtual ~Texture() noexcept
     {
         if (owned_gbuf) { delete gbuf_p; }
     }
 
     Texture(Texture const& tex) noexcept
-    : method{tex.method}, gbuf_p{new GraphicsBuffer(*tex.gbuf_p)}, owned_gbuf{true} {}
+    : _mipmaps{tex._mipmaps}, method{tex.method}, gbuf_p{(tex.gbuf_p != nullptr) ? new GraphicsBuffer(*tex.gbuf_p) : nullptr}, owned_gbuf{true},
+      tiled_p{tex.tiled_p} {}
     Texture(Texture && tex) noexcept
-    : method{tex.method}, gbuf_p{std::exchange(tex.gbuf_p, nullptr)}, owned_gbuf{std::exchange(tex.owned_gbuf, false)} {}
+    : _mipmaps{std::move(tex._mipmaps)}, method{tex.method}, gbuf_p{std::exchange(tex.gbuf_p, nullptr)}, owned_gbuf{std::exchange(tex.owned_gbuf, false)},
+      tiled_p{std::move(tex.tiled_p)} {}
 
     Texture & remove_gamma() noexcept
     {
@@ -42,14 +85,42 @@ public:
     }
 
 
+    // build the mip pyramid down to 1x1, tiled images have built theirs while loaded
     virtual bool prepare() noexcept override
     {
-        return gbuf_p != nullptr;
+        if (tiled_p != nullptr) { return tiled_p->levels() > 0; }
+        if (gbuf_p == nullptr) { return false; }
+
+        _mipmaps.clear();
+        for (GraphicsBuffer const* level_p = gbuf_p; (level_p->width() > 1) || (level_p->height() > 1); level_p = &_mipmaps.back())
+        {
+            _mipmaps.emplace_back(_downsample(*level_p));
+        }
+        return true;
+    }
+
+    // the level of detail from the width of ray cone at hit point, see "Texture Level of Detail Strategies for Real-Time Ray Tracing"
+    f32 level_of_detail(Ray const& ray, TraceRecord const& rec) const noexcept
+    {
+        fg const cone_width = rec.cone_width + rec.cone_spread * rec.max_ray_time;
+        fg const c = std::max(std::abs(dot(ray.direction, rec.face_normal)), fg(1e-2));
+        u64 const total = (tiled_p != nullptr) ? tiled_p->total() : gbuf_p->total();
+        fg const texels = cone_width * rec.hit_texture_scale * std::sqrt(fg(total)) / c;
+        return (texels > 1) ? f32(std::log2(texels)) : 0.0f;
     }
 
+    // trilinear between two levels of mip pyramid, only the full resolution image is used if magnified
     virtual RGB operator () (Ray const& ray, TraceRecord const& rec) const noexcept override
     {
-        return method(gbuf_p->begin(), gbuf_p->size(), rec.hit_texture);
+        u32 const levels = _levels();
+        f32 const lod = std::min(level_of_detail(ray, rec), f32(levels - 1));
+        if (lod <= 0) { return _lookup(0, rec.hit_texture); }
+
+        u32 const level = static_cast<u32>(lod);
+        f32 const t = lod - level;
+        RGB const color = _lookup(level, rec.hit_texture);
+        if ((t <= 0) || (level + 1 >= levels)) { return color; }
+        return lerp(color, _lookup(level + 1, rec.hit_texture), t);
     }
 
 
@@ -68,6 +139,19 @@ public:
         if (remove_gamma) { tex->remove_gamma(); }
         return tex;
     }
+
+    // short cut load texture from file as tiles, which are decoded on demand into `cache_p`,
+    // so that the whole image is never resident. `Loader` should read pixels by pieces like `image_formats::QOI`
+    template<class Loader> static auto load_tiled(Interpolation method, std::filesystem::path path, TiledImage::CachePtr cache_p = TileCache::shared(), bool remove_gamma = true)
+    {
+        auto tex = std::make_shared<Texture>();
+        tex->method = method;
+
+        auto tiled = std::make_shared<TiledImage>(cache_p);
+        if (!(tiled->template load<Loader>(path, remove_gamma))) { return tex; }
+        tex->tiled_p = tiled;
+        return tex;
+    }
 };
 
 } // namespace materials
@@ -13,7 +13,7 @@ public:
 
     RGB top_color, bottom_color;
 
-    VEC_CONSTEXPR GradientSky(RGB const& top, RGB const& bottom)
+    GradientSky(RGB const& top, RGB const& bottom)
     : top_color{top}, bottom_color{bottom} {}
     virtual ~GradientSky() noexcept = default;
 
@@ -97,7 +97,7 @@ protected:
 
 public:
 
-    VEC_CONSTEXPR Hosek() noexcept
+    Hosek() noexcept
     : _solar_direcion{normalize(consts<vec3g>::X + consts<vec3g>::Z)}, _turbidity{5}, _albedo(consts<RGB>::White) {}
     virtual ~Hosek() noexcept = default;
 
@@ -161,7 +161,7 @@ public:
             _coefs[k] += weight * interpolate(_get_coefs(ps, 1, t_index, k));
         }
 
-        if (t_index == 10) { return true; }
+        if (t_index == 10) { return Sky::prepare(); }
 
         // alb 0 high turb
         weight = (1.0f - _albedo) * t_rem;
@@ -179,7 +179,7 @@ public:
             _coefs[k] += weight * interpolate(_get_coefs(ps, 1, t_index + 1, k));
         }
 
-        return true;
+        return Sky::prepare();
     }
 
 
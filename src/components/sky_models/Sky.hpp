@@ -1,6 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <math.h>
+#include <tuple>
+#include <vector>
+
 #include "../../common.hpp"
+#include "../../graphics/GraphicsBuffer.hpp"
+#include "../../graphics/Interpolation.hpp"
 
 
 namespace nyasRT
@@ -9,11 +16,131 @@ namespace sky_models
 {
 class Sky
 {
+protected:
+
+    // the sky baked in lat-long form, `u = φ / 2π` & `v = θ / π` where θ is the angle to +Z
+    size2_t _baked_size;
+    GraphicsBuffer _baked;
+    // piecewise constant distribution on lat-long map proportional to `luminance * sinθ`
+    std::vector<f32> _baked_pdf;        // the density in uv space of each pixel
+    std::vector<f32> _marginal_cdf;     // cdf of rows, `height + 1` elements
+    std::vector<f32> _conditional_cdf;  // cdf in each row, `width + 1` elements per row
+
+    static inline vec2g _direction_to_uv(normal3g const& direction) noexcept
+    {
+        fg const u = std::atan2(direction.y, direction.x) * (consts<fg>::half / consts<fg>::pi) + consts<fg>::half;
+        fg const v = std::acos(std::min(std::max(direction.z, fg(-1)), fg(1))) / consts<fg>::pi;
+        return vec2g(u, v);
+    }
+    u64 _baked_index(vec2g const& uv) const noexcept
+    {
+        u32 const i = std::min(static_cast<u32>(uv.x * _baked_size.x), _baked_size.x - 1);
+        u32 const j = std::min(static_cast<u32>(uv.y * _baked_size.y), _baked_size.y - 1);
+        return i + u64(j) * _baked_size.x;
+    }
+
+    // bake the sky and build its distribution, do nothing if not required
+    bool _bake()
+    {
+        _baked = GraphicsBuffer{};
+        _baked_pdf.clear(); _marginal_cdf.clear(); _conditional_cdf.clear();
+        if ((_baked_size.x == 0) || (_baked_size.y == 0)) { return true; }
+
+        u32 const width = _baked_size.x, height = _baked_size.y;
+        _baked = GraphicsBuffer(_baked_size);
+        _baked_pdf.resize(_baked.total());
+        _marginal_cdf.resize(height + 1);
+        _conditional_cdf.resize(u64(width + 1) * height);
+
+        _marginal_cdf[0] = 0;
+        for (u32 j = 0; j < height; j++)
+        {
+            fg const theta = (j + consts<fg>::half) * consts<fg>::pi / height;
+            fg const stheta = std::sin(theta), ctheta = std::cos(theta);
+            f32 * cdf = _conditional_cdf.data() + u64(width + 1) * j;
+            cdf[0] = 0;
+            for (u32 i = 0; i < width; i++)
+            {
+                fg const phi = (i + consts<fg>::half) * consts<fg>::two_pi / width - consts<fg>::pi;
+                RGB const color = (*this)(vec3g(stheta * std::cos(phi), stheta * std::sin(phi), ctheta));
+                _baked[i + u64(j) * width] = color;
+                _baked_pdf[i + u64(j) * width] = std::max(0.0f, luminance(color)) * f32(stheta);
+                cdf[i + 1] = cdf[i] + _baked_pdf[i + u64(j) * width];
+            }
+            _marginal_cdf[j + 1] = _marginal_cdf[j] + cdf[width];
+            for (u32 i = 1; i <= width; i++) { cdf[i] = (cdf[width] > 0) ? cdf[i] / cdf[width] : f32(i) / width; }
+        }
+
+        f32 const total = _marginal_cdf[height];
+        for (u32 j = 1; j <= height; j++) { _marginal_cdf[j] = (total > 0) ? _marginal_cdf[j] / total : f32(j) / height; }
+        for (f32 & p : _baked_pdf) { p = (total > 0) ? p * _baked.total() / total : 0; }
+        return true;
+    }
+
 public:
 
+    Sky() noexcept
+    : _baked_size{0, 0} {}
+    virtual ~Sky() noexcept = default;
+
     virtual bool prepare() noexcept
     {
-        return true;
+        return _bake();
+    }
+
+    // bake the sky into a lat-long map of `size` while prepared, so that it can be looked up & sampled as a light.
+    // zero size to evaluate the sky directly
+    Sky & bake(size2_t size) noexcept
+    {
+        _baked_size = size;
+        return *this;
+    }
+    size2_t baked_size() const noexcept
+    {
+        return _baked_size;
+    }
+    bool baked() const noexcept
+    {
+        return !_baked_pdf.empty();
+    }
+
+    // the sky color from the baked map if baked, interpolated bilinearly between the centers of pixels.
+    // `u` wraps around & `v` is clamped to the centers of the first & last rows at the poles
+    RGB radiance(normal3g const& direction) const noexcept
+    {
+        if (!baked()) { return (*this)(direction); }
+        vec2g const uv = _direction_to_uv(direction);
+        vec2g const half_pixel = consts<fg>::half / vec2g(_baked_size);
+        vec2g const pos(uv.x - half_pixel.x + 1, std::min(std::max(uv.y, half_pixel.y), 1 - half_pixel.y) - half_pixel.y);
+        return Interpolation::bilinear(_baked.data(), _baked_size, pos);
+    }
+
+    /// @return direction & its probability density in solid angle, only valid if baked
+    std::tuple<normal3g, f32> sample(vec2g const& uv) const noexcept
+    {
+        u32 const width = _baked_size.x, height = _baked_size.y;
+
+        u32 const j = std::min<u32>(std::upper_bound(_marginal_cdf.begin() + 1, _marginal_cdf.end(), f32(uv.y)) - _marginal_cdf.begin() - 1, height - 1);
+        f32 const* cdf = _conditional_cdf.data() + u64(width + 1) * j;
+        u32 const i = std::min<u32>(std::upper_bound(cdf + 1, cdf + width + 1, f32(uv.x)) - cdf - 1, width - 1);
+
+        f32 const dv = _marginal_cdf[j + 1] - _marginal_cdf[j], du = cdf[i + 1] - cdf[i];
+        fg const v = (j + ((dv > 0) ? (uv.y - _marginal_cdf[j]) / dv : consts<fg>::half)) / height;
+        fg const u = (i + ((du > 0) ? (uv.x - cdf[i]) / du : consts<fg>::half)) / width;
+
+        fg const theta = v * consts<fg>::pi, phi = u * consts<fg>::two_pi - consts<fg>::pi;
+        fg const stheta = std::sin(theta);
+        normal3g const direction(stheta * std::cos(phi), stheta * std::sin(phi), std::cos(theta));
+        if (stheta <= 0) { return {direction, 0}; }
+        return {direction, _baked_pdf[i + u64(j) * width] / f32(2 * consts<fg>::pi * consts<fg>::pi * stheta)};
+    }
+
+    // the probability density in solid angle of `sample` choosing `direction`, only valid if baked
+    f32 pdf(normal3g const& direction) const noexcept
+    {
+        fg const stheta = std::sqrt(std::max(fg(0), 1 - sqr(direction.z)));
+        if (stheta <= 0) { return 0; }
+        return _baked_pdf[_baked_index(_direction_to_uv(direction))] / f32(2 * consts<fg>::pi * consts<fg>::pi * stheta);
     }
 
     virtual RGB operator () (normal3g const& direction) const noexcept = 0;
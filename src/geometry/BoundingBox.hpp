@@ -58,11 +58,28 @@ public:
         max_corner = max(max_corner, point);
         return *this;
     }
+    VEC_CONSTEXPR BoundingBox & bound(BoundingBox const& box) noexcept
+    {
+        using glm::min, glm::max;
+        min_corner = min(min_corner, box.min_corner);
+        max_corner = max(max_corner, box.max_corner);
+        return *this;
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return (min_corner.x > max_corner.x) || (min_corner.y > max_corner.y) || (min_corner.z > max_corner.z);
+    }
 
     VEC_CONSTEXPR vec3g size() const noexcept
     {
         return max_corner - min_corner;
     }
+    VEC_CONSTEXPR fg surface_area() const noexcept
+    {
+        vec3g const s = size();
+        return 2 * (s.x * s.y + s.y * s.z + s.z * s.x);
+    }
 
     static constexpr inline bool intersect(fg time_in, fg time_out, fg max_ray_time) noexcept
     {
@@ -1,18 +1,29 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <limits>
 #include <math.h>
 #include <memory>
 #include <numeric>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "../common.hpp"
+#include "../MappedFile.hpp"
 #include "BoundingBox.hpp"
+#include "ObjParser.hpp"
 #include "Ray.hpp"
 #include "Transform.hpp"
+#include "WideBoundingBox.hpp"
+#include "WideTriangle.hpp"
 
 
 namespace nyasRT
@@ -50,7 +61,7 @@ protected:
     public:
 
         BoundingBox box;
-        u32 index_l; // the index to left child node or to triangle if is leaf
+        u32 index_l; // the index to left child node or to triangle if is leaf, or to the first pack of wide triangles if they are built
         u32 index_r; // the index to right child node or the length of triangles if is leaf, and the highest bit indicate this is leaf or not
 
         static constexpr u32 leafbit = 0x80000000;
@@ -93,195 +104,822 @@ protected:
         }
     };
 
+    // node of the wide bounding volume hierarchy, collapsed from the binary one
+    template<u32 W> class WideBoxNode
+    {
+    public:
+
+        WideBoundingBox<W> boxes;
+        u32 index_l[W]; // same as `BoxNode::index_l` of each child
+        u32 index_r[W]; // the length of triangles and the leafbit if the child is leaf, otherwise 0
+
+        VEC_CONSTEXPR WideBoxNode() noexcept
+        : boxes{}, index_l{}, index_r{} {
+            // empty children are empty leaves with empty boxes, which are never in the mask of `WideBoundingBox::trace`
+            for (u32 k = 0; k < W; k++) { index_r[k] = BoxNode::leafbit; }
+        }
+    };
+
 
     static constexpr u32 max_triangles_per_box = 10;
     static constexpr u32 max_boxes_depth = 32;
     static constexpr u32 max_strategy_iterations = 32;
 
-    enum class DividingStrategy { X, Y, Z };
+    static constexpr u32 parallel_subtree_triangles = 1 << 14;
+    static constexpr u32 prepare_chunk_size = 1 << 12;
 
-    void _build_bounding_volume_hierarchy()
+    static constexpr u32 sah_n_bins = 16;
+    static constexpr fg sah_box_cost = 1;
+    static constexpr fg sah_triangle_cost = 1;
+
+    class FaceInfo
     {
-        // pre-calculate some useful informations
-        std::vector<std::tuple<vec3g, fg>> center_areas;
-        center_areas.reserve(_faces.size());
-        for (indices_t vertex_indices : _faces)
+    public:
+
+        vec3g center;
+        fg area;
+        BoundingBox box;
+    };
+
+    // the header of prepared mesh file, followed by the arrays in `_prepared_arrays`, each aligned to `prepared_alignment`
+    class PreparedHeader
+    {
+    public:
+
+        u64 magic;
+        u32 version;
+        u32 layout[7];  // the sizes of `fg`, `indices_t`, `BoxNode`, `WideBoxNode<4>`, `WideBoxNode<8>`, `WideTriangle<4>` & `WideTriangle<8>`
+        u32 flags;      // `enable_normal_interpolation` & `custom_vertex_normals`
+        u32 bvh_width;
+        u32 leaf_width;
+        u32 triangle_test;
+        u64 counts[11]; // the number of elements in each array
+    };
+
+    static constexpr u64 prepared_magic = 0x6873654D5452736Eull;    // "nsRTMesh"
+    static constexpr u32 prepared_version = 5;
+    static constexpr u64 prepared_alignment = 64;
+    static constexpr u32 n_prepared_arrays = 11;
+    static_assert(prepared_alignment <= MappedFile::alignment, "the arrays in prepared mesh file must be aligned in memory as well");
+
+    static constexpr inline u64 _prepared_align(u64 offset) noexcept
+    {
+        return (offset + prepared_alignment - 1) / prepared_alignment * prepared_alignment;
+    }
+    template<class Self> static auto _prepared_arrays(Self & self) noexcept
+    {
+        return std::tie(self._vertices, self._vertex_normals, self._vertex_uv, self._faces, self._face_normals, self._face_consts,
+            self._boxes, self._wide4_boxes, self._wide8_boxes, self._wide4_triangles, self._wide8_triangles);
+    }
+    PreparedHeader _prepared_header() const noexcept
+    {
+        PreparedHeader header{};
+        header.magic = prepared_magic;
+        header.version = prepared_version;
+        header.layout[0] = sizeof(fg); header.layout[1] = sizeof(indices_t); header.layout[2] = sizeof(BoxNode);
+        header.layout[3] = sizeof(WideBoxNode<4>); header.layout[4] = sizeof(WideBoxNode<8>);
+        header.layout[5] = sizeof(WideTriangle<4>); header.layout[6] = sizeof(WideTriangle<8>);
+        header.flags = (enable_normal_interpolation ? 1 : 0) | (custom_vertex_normals ? 2 : 0);
+        header.bvh_width = bvh_width;
+        header.leaf_width = leaf_width;
+        header.triangle_test = static_cast<u32>(triangle_test);
+        return header;
+    }
+
+    // the faces of a leaf, or its packs of wide triangles, are in the arrays. `leaf_width_` is the one of loaded file
+    bool _prepared_leaf_valid(u32 leaf_start, u32 n_faces, u32 leaf_width_) const noexcept
+    {
+        if (leaf_width_ == 1) { return (leaf_start < _faces.size()) && (n_faces <= _faces.size() - leaf_start); }
+        u64 const n_packs = (leaf_width_ == 4) ? _wide4_triangles.size() : _wide8_triangles.size();
+        return (leaf_start <= n_packs) && ((u64(n_faces) + leaf_width_ - 1) / leaf_width_ <= n_packs - leaf_start);
+    }
+    // the children are after their parents & referred only once, so that the hierarchy is a tree not deeper than
+    // `max_boxes_depth`, which the stacks of tracing are sized for
+    template<u32 W, class Node> bool _prepared_hierarchy_valid(MappedArray<Node> const& nodes, u32 leaf_width_) const noexcept
+    {
+        if (nodes.empty()) { return true; }
+        std::vector<u8> depths(nodes.size(), 0);
+        depths[0] = 1;
+        for (u64 node_index = 0; node_index < nodes.size(); node_index++)
+        {
+            for (u32 k = 0; k < W; k++)
+            {
+                u32 index_l, index_r;
+                if constexpr (W == 2)
+                {
+                    if (nodes[node_index].isleaf())
+                    {
+                        if (!_prepared_leaf_valid(nodes[node_index].triangle_start(), nodes[node_index].triangles_length(), leaf_width_)) { return false; }
+                        break;
+                    }
+                    index_l = (k == 0) ? nodes[node_index].leftchild() : nodes[node_index].rightchild();
+                    index_r = 0;
+                }
+                else
+                {
+                    index_l = nodes[node_index].index_l[k];
+                    index_r = nodes[node_index].index_r[k];
+                }
+
+                if ((index_r & BoxNode::leafbit) != 0)
+                {
+                    if (!_prepared_leaf_valid(index_l, index_r & (~BoxNode::leafbit), leaf_width_)) { return false; }
+                    continue;
+                }
+                if ((index_l <= node_index) || (index_l >= nodes.size()) || (depths[index_l] != 0) || (depths[node_index] >= max_boxes_depth)) { return false; }
+                depths[index_l] = depths[node_index] + 1;
+            }
+        }
+        return true;
+    }
+    template<u32 W> bool _prepared_triangles_valid(MappedArray<WideTriangle<W>> const& wide_triangles) const noexcept
+    {
+        for (WideTriangle<W> const& pack : wide_triangles)
+        {
+            for (u32 k = 0; k < W; k++) { if (pack.face[k] >= _faces.size()) { return false; } }
+        }
+        return true;
+    }
+    // check the sizes of arrays & every index stored in them after loading, so that corrupted files cannot be traced out of bounds
+    bool _prepared_valid(u32 bvh_width_, u32 leaf_width_) const noexcept
+    {
+        u64 const n_vertices = _vertices.size(), n_faces = _faces.size();
+        if ((n_vertices == 0) || (n_faces == 0) || _boxes.empty()) { return false; }
+        if ((_vertex_normals.size() != n_vertices) || (_vertex_uv.size() != n_vertices)) { return false; }
+        if ((_face_normals.size() != n_faces) || (_face_consts.size() != n_faces)) { return false; }
+        // only the arrays for the widths of file
+        if ((_wide4_boxes.empty() == (bvh_width_ == 4)) || (_wide8_boxes.empty() == (bvh_width_ == 8))) { return false; }
+        if ((_wide4_triangles.empty() == (leaf_width_ == 4)) || (_wide8_triangles.empty() == (leaf_width_ == 8))) { return false; }
+
+        for (indices_t const& vertex_indices : _faces)
         {
-            vec3g const& A = _vertices[vertex_indices.x];
-            vec3g const& B = _vertices[vertex_indices.y];
-            vec3g const& C = _vertices[vertex_indices.z];
+            if ((vertex_indices.x >= n_vertices) || (vertex_indices.y >= n_vertices) || (vertex_indices.z >= n_vertices)) { return false; }
+        }
+        return _prepared_hierarchy_valid<2>(_boxes, leaf_width_)
+            && _prepared_hierarchy_valid<4>(_wide4_boxes, leaf_width_) && _prepared_hierarchy_valid<8>(_wide8_boxes, leaf_width_)
+            && _prepared_triangles_valid(_wide4_triangles) && _prepared_triangles_valid(_wide8_triangles);
+    }
 
-            // old, correct behavior: ((B - A) + (C - A)).mul(consts<fg>::third).add(A)
-            vec3g center = consts<fg>::third * (A + B + C);
-            fg area = consts<fg>::half * length(cross(B - A, C - A));
+    void _swap_faces(u32 index0, u32 index1, std::vector<FaceInfo> & face_infos) noexcept
+    {
+        std::swap(       _faces[index0],        _faces[index1]);
+        std::swap(_face_normals[index0], _face_normals[index1]);
+        std::swap( _face_consts[index0],  _face_consts[index1]);
+        std::swap(   face_infos[index0],    face_infos[index1]);
+    }
 
-            center_areas.emplace_back(center, area);
+    // move the triangles satisfied `to_left` to the front, and returns the index of the first triangle in the right part
+    template<class F> u32 _partition_faces(u32 face_start, u32 face_stop, std::vector<FaceInfo> & face_infos, F const& to_left) noexcept
+    {
+        u32 right_start = face_start;
+        for (u32 index = face_start; index < face_stop; index++)
+        {
+            if (to_left(face_infos[index]))
+            {
+                if (right_start != index) { _swap_faces(right_start, index, face_infos); }
+                right_start++;
+            }
         }
+        return right_start;
+    }
 
-        _boxes.clear();
-        std::vector<u32> boxes_depth;
-        // global box
-        _boxes.emplace_back(_vertices.data(), _faces.data(), 0, _faces.size());
-        boxes_depth.emplace_back(1);
+    // find the dividing line on each axes so that each halves have almost the same area.
+    u32 _divide_area_balancing(BoxNode const& box_node, std::vector<FaceInfo> & face_infos) noexcept
+    {
+        u32 face_start = box_node.triangle_start();
+        u32 face_stop = face_start + box_node.triangles_length();
+        vec3g box_size = box_node.box.size();
+
+        u32 axis = 0;
+        fg left_area = 0, right_area = 1;
+        fg divide_line = 0;
+
+        for (u32 a = 0; a < 3; a++)
+        {
+            fg l_a = 0, r_a = 1;
+            fg d_l = box_node.box.min_corner[a];
+            for (u32 iter = 0; iter < max_strategy_iterations; iter++)
+            {
+                // set a new dividing line
+                fg min_distance = consts<fg>::inf, delta = box_size[a] / (1 << (iter + 1));
+                d_l += delta * (l_a > r_a ? -1 : 1);
+                // calculate how many area in each side
+                l_a = r_a = 0;
+                for (u32 index = face_start; index < face_stop; index++)
+                {
+                    FaceInfo const& info = face_infos[index];
+                    fg tmp = info.center[a] - d_l;
+                    min_distance = std::min(min_distance, std::abs(tmp));
+                    if (tmp <= 0) { l_a += info.area; }
+                    else { r_a += info.area; }
+                }
+                if (min_distance >= delta) { break; } // even the nearest triangle is too far to reach
+            }
+            // replace the strategy if the divide on this axis is better than above
+            if ((a == 0) || (std::abs(l_a - r_a) < std::abs(left_area - right_area)))
+            {
+                axis = a;
+                divide_line = d_l;
+                left_area = l_a; right_area = r_a;
+            }
+        }
+
+        // the divide strategy failed
+        if ((left_area <= consts<fg>::eps) || (right_area <= consts<fg>::eps)) { return face_start; }
+
+        return _partition_faces(face_start, face_stop, face_infos, [axis, divide_line] (FaceInfo const& info) noexcept -> bool
+        {
+            return info.center[axis] < divide_line;
+        });
+    }
+
+    // find the dividing line with the lowest cost estimated by surface area heuristic,
+    // triangles are binned by their centers so that each axis only needs one sweep.
+    u32 _divide_surface_area_heuristic(BoxNode const& box_node, std::vector<FaceInfo> & face_infos) noexcept
+    {
+        u32 face_start = box_node.triangle_start();
+        u32 face_stop = face_start + box_node.triangles_length();
+
+        BoundingBox centers_box;
+        for (u32 index = face_start; index < face_stop; index++) { centers_box.bound(face_infos[index].center); }
+        vec3g const centers_size = centers_box.size();
+
+        class Bin
+        {
+        public:
+
+            BoundingBox box;
+            u32 count = 0;
+        };
+
+        fg best_cost = consts<fg>::inf;
+        u32 best_axis = 0, best_bin = 0;
+
+        for (u32 axis = 0; axis < 3; axis++)
+        {
+            if (centers_size[axis] < consts<fg>::eps) { continue; }
+            fg const bin_scale = sah_n_bins / centers_size[axis];
+            fg const bin_start = centers_box.min_corner[axis];
+
+            Bin bins[sah_n_bins];
+            for (u32 index = face_start; index < face_stop; index++)
+            {
+                FaceInfo const& info = face_infos[index];
+                u32 bin_index = std::min(sah_n_bins - 1, static_cast<u32>((info.center[axis] - bin_start) * bin_scale));
+                bins[bin_index].box.bound(info.box);
+                bins[bin_index].count++;
+            }
+
+            // sweep from right to left, `right_costs[k]` is the cost of bins in [k, sah_n_bins)
+            fg right_costs[sah_n_bins];
+            BoundingBox bounded;
+            u32 bounded_count = 0;
+            for (u32 k = sah_n_bins - 1; k > 0; k--)
+            {
+                bounded.bound(bins[k].box);
+                bounded_count += bins[k].count;
+                right_costs[k] = (bounded_count > 0) ? bounded.surface_area() * bounded_count : consts<fg>::inf;
+            }
+
+            // sweep from left to right
+            bounded.reset();
+            bounded_count = 0;
+            for (u32 k = 1; k < sah_n_bins; k++)
+            {
+                bounded.bound(bins[k - 1].box);
+                bounded_count += bins[k - 1].count;
+                if (bounded_count == 0) { continue; }
+
+                fg cost = bounded.surface_area() * bounded_count + right_costs[k];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = k;
+                }
+            }
+        }
+
+        // all triangle centers are too close to be divided
+        if (best_bin == 0) { return face_start; }
+        // dividing is more expensive than tracing all triangles, but large box must be divided anyway
+        fg leaf_cost = sah_triangle_cost * (face_stop - face_start);
+        fg divided_cost = sah_box_cost + sah_triangle_cost * best_cost / box_node.box.surface_area();
+        if ((divided_cost >= leaf_cost) && (face_stop - face_start <= 2 * max_triangles_per_box)) { return face_start; }
+
+        fg const bin_scale = sah_n_bins / centers_size[best_axis];
+        fg const bin_start = centers_box.min_corner[best_axis];
+        return _partition_faces(face_start, face_stop, face_infos, [=] (FaceInfo const& info) noexcept -> bool
+        {
+            return std::min(sah_n_bins - 1, static_cast<u32>((info.center[best_axis] - bin_start) * bin_scale)) < best_bin;
+        });
+    }
 
-        u32 box_index = 0, box_count = 1;
+    // divide boxes in breadth-first order starting from `boxes[box_index]`, the new boxes are appended to `boxes`.
+    // if `subtrees` is not null, boxes with not more than `parallel_subtree_triangles` triangles are collected into it instead of being divided.
+    template<class Boxes> void _divide_boxes(Boxes & boxes, std::vector<u32> & boxes_depth, u32 box_index, std::vector<FaceInfo> & face_infos, std::vector<u32> * subtrees)
+    {
+        u32 box_count = boxes.size();
         for (; box_index < box_count; box_index++)
         {
-            BoxNode & box_node = _boxes[box_index];
+            BoxNode & box_node = boxes[box_index];
             u32 box_depth = boxes_depth[box_index];
             // if this box have so much triangles, then divide it in half
             if ((box_node.triangles_length() > max_triangles_per_box) && (box_depth < max_boxes_depth))
             {
+                if ((subtrees != nullptr) && (box_node.triangles_length() <= parallel_subtree_triangles))
+                {
+                    subtrees->push_back(box_index);
+                    continue;
+                }
+
                 u32 face_start = box_node.triangle_start();
                 u32 face_stop = face_start + box_node.triangles_length();
-                vec3g box_size = box_node.box.size();
-
-                // find the best divide strategy on each axes so that each halves have almost the same area.
 
-                // divide on x-axis
-                DividingStrategy strategy = DividingStrategy::X;
-                fg left_area = 0, right_area = 1;
-                fg divide_line = box_node.box.min_corner.x;
-                for (u32 iter = 0; iter < max_strategy_iterations; iter++)
+                u32 right_start;
+                switch (bvh_builder)
                 {
-                    // set a new dividing line
-                    fg min_distance = consts<fg>::inf, delta = box_size.x / (1 << (iter + 1));
-                    divide_line += delta * (left_area > right_area ? -1 : 1);
-                    // calculate how many area in each side
-                    left_area = right_area = 0;
-                    for (u32 index = face_start; index < face_stop; index++)
-                    {
-                        auto const& info = center_areas[index];
-                        fg tmp = std::get<0>(info).x - divide_line;
-                        min_distance = std::min(min_distance, std::abs(tmp));
-                        if (tmp <= 0) { left_area += std::get<1>(info); }
-                        else { right_area += std::get<1>(info); }
-                    }
-                    if (min_distance >= delta) { break; } // even the nearest triangle is too far to reach
+                case BVHBuilder::SurfaceAreaHeuristic:
+                    right_start = _divide_surface_area_heuristic(box_node, face_infos);
+                    break;
+                default:
+                    right_start = _divide_area_balancing(box_node, face_infos);
+                    break;
                 }
 
-                // divide on y-axis
-                fg l_a = 0, r_a = 1;
-                fg d_l = box_node.box.min_corner.y;
-                for (u32 iter = 0; iter < max_strategy_iterations; iter++)
+                // divide this box in halves if the divide strategy success
+                if ((face_start < right_start) && (right_start < face_stop))
                 {
-                    // set a new dividing line
-                    fg min_distance = consts<fg>::inf, delta = box_size.y / (1 << (iter + 1));
-                    d_l += delta * (l_a > r_a ? -1 : 1);
-                    // calculate how many area in each side
-                    l_a = r_a = 0;
-                    for (u32 index = face_start; index < face_stop; index++)
-                    {
-                        auto const& info = center_areas[index];
-                        fg tmp = std::get<0>(info).y - d_l;
-                        min_distance = std::min(min_distance, std::abs(tmp));
-                        if (tmp <= 0) { l_a += std::get<1>(info); }
-                        else { r_a += std::get<1>(info); }
-                    }
-                    if (min_distance >= delta) { break; } // even the nearest triangle is too far to reach
+                    // contruct child-boxes
+                    box_node.index_l = box_count++;
+                    box_node.index_r = box_count++;
+                    boxes_depth.emplace_back(box_depth + 1);
+                    boxes_depth.emplace_back(box_depth + 1);
+                    boxes.emplace_back(_vertices.data(), _faces.data(), face_start, right_start - face_start);
+                    boxes.emplace_back(_vertices.data(), _faces.data(), right_start, face_stop - right_start);
                 }
-                // replace the strategy if the divide on y-axis is better than on x-aixs
-                if (std::abs(l_a - r_a) < std::abs(left_area - right_area))
+            }
+        }
+    }
+
+    void _build_bounding_volume_hierarchy()
+    {
+        // pre-calculate some useful informations
+        std::vector<FaceInfo> face_infos(_faces.size());
+        parallel_for(n_prepare_threads, (_faces.size() + prepare_chunk_size - 1) / prepare_chunk_size, [&] (u64 chunk)
+        {
+            u64 const stop = std::min<u64>((chunk + 1) * prepare_chunk_size, _faces.size());
+            for (u64 face_index = chunk * prepare_chunk_size; face_index < stop; face_index++)
+            {
+                indices_t const& vertex_indices = _faces[face_index];
+                vec3g const& A = _vertices[vertex_indices.x];
+                vec3g const& B = _vertices[vertex_indices.y];
+                vec3g const& C = _vertices[vertex_indices.z];
+
+                FaceInfo & info = face_infos[face_index];
+                // old, correct behavior: ((B - A) + (C - A)).mul(consts<fg>::third).add(A)
+                info.center = consts<fg>::third * (A + B + C);
+                info.area = consts<fg>::half * length(cross(B - A, C - A));
+                info.box.bound(A).bound(B).bound(C);
+            }
+        });
+
+        _boxes.clear();
+        std::vector<u32> boxes_depth;
+        // global box
+        _boxes.emplace_back(_vertices.data(), _faces.data(), 0, _faces.size());
+        boxes_depth.emplace_back(1);
+
+        // divide the top boxes, and leave the small boxes as subtrees
+        std::vector<u32> subtrees;
+        _divide_boxes(_boxes, boxes_depth, 0, face_infos, &subtrees);
+
+        // each subtree is built on its own with local indices, the triangles in different subtrees are not overlapped,
+        // so that they can be divided in parallel, and the result is not depending on the number of threads.
+        std::vector<std::vector<BoxNode>> subtrees_boxes(subtrees.size());
+        parallel_for(n_prepare_threads, subtrees.size(), [&] (u64 subtree_index)
+        {
+            u32 const root_index = subtrees[subtree_index];
+            std::vector<BoxNode> & boxes = subtrees_boxes[subtree_index];
+            std::vector<u32> depth{boxes_depth[root_index]};
+            boxes.push_back(_boxes[root_index]);
+            _divide_boxes(boxes, depth, 0, face_infos, nullptr);
+        });
+
+        // merge subtrees into the hierarchy in order
+        for (u32 subtree_index = 0; subtree_index < subtrees.size(); subtree_index++)
+        {
+            std::vector<BoxNode> const& boxes = subtrees_boxes[subtree_index];
+            u32 const offset = _boxes.size() - 1;   // the local index 0 is the root, which is already in `_boxes`
+            for (u32 local_index = 0; local_index < boxes.size(); local_index++)
+            {
+                BoxNode box_node = boxes[local_index];
+                if (!box_node.isleaf())
                 {
-                    strategy = DividingStrategy::Y;
-                    divide_line = d_l;
-                    left_area = l_a; right_area = r_a;
+                    box_node.index_l += offset;
+                    box_node.index_r += offset;
                 }
+                if (local_index == 0) { _boxes[subtrees[subtree_index]] = box_node; }
+                else { _boxes.push_back(box_node); }
+            }
+        }
+
+        // renumber boxes in breadth-first order, the same as dividing all boxes in one pass
+        std::vector<BoxNode> ordered;
+        ordered.reserve(_boxes.size());
+        ordered.push_back(_boxes.front());
+        for (u32 box_index = 0; box_index < ordered.size(); box_index++)
+        {
+            BoxNode & box_node = ordered[box_index];
+            if (box_node.isleaf()) { continue; }
+
+            u32 const child_l = box_node.leftchild(), child_r = box_node.rightchild();
+            box_node.index_l = ordered.size();
+            box_node.index_r = ordered.size() + 1;
+            ordered.push_back(_boxes[child_l]);
+            ordered.push_back(_boxes[child_r]);
+        }
+        _boxes.swap(ordered);
+    }
+
+    // collapse the binary bounding volume hierarchy into `W`-wide one, the children of each wide node are
+    // chosen by repeatedly opening the child with the largest surface area.
+    template<u32 W> void _collapse_bounding_volume_hierarchy(MappedArray<WideBoxNode<W>> & wide_boxes) const
+    {
+        wide_boxes.clear();
+        if (_boxes.empty()) { return; }
+        wide_boxes.emplace_back();
 
-                // divide on z-axis
-                l_a = 0; r_a = 1;
-                d_l = box_node.box.min_corner.z;
-                for (u32 iter = 0; iter < max_strategy_iterations; iter++)
+        std::vector<std::tuple<u32 /* box index */, u32 /* wide box index */>> to_collapse{{0, 0}};
+        while (!to_collapse.empty())
+        {
+            auto [box_index, wide_index] = to_collapse.back();
+            to_collapse.pop_back();
+
+            u32 children[W];
+            u32 n_children = 0;
+            if (BoxNode const& box_node = _boxes[box_index]; box_node.isleaf()) { children[n_children++] = box_index; }
+            else
+            {
+                children[n_children++] = box_node.leftchild();
+                children[n_children++] = box_node.rightchild();
+            }
+            while (n_children < W)
+            {
+                u32 open_index = W;
+                fg max_area = -1;
+                for (u32 k = 0; k < n_children; k++)
                 {
-                    // set a new dividing line
-                    fg min_distance = consts<fg>::inf, delta = box_size.z / (1 << (iter + 1));
-                    d_l += delta * (l_a > r_a ? -1 : 1);
-                    // calculate how many area in each side
-                    l_a = r_a = 0;
-                    for (u32 index = face_start; index < face_stop; index++)
+                    BoxNode const& child = _boxes[children[k]];
+                    if (fg area = child.box.surface_area(); !child.isleaf() && (area > max_area))
                     {
-                        auto const& info = center_areas[index];
-                        fg tmp = std::get<0>(info).z - d_l;
-                        min_distance = std::min(min_distance, std::abs(tmp));
-                        if (tmp <= 0) { l_a += std::get<1>(info); }
-                        else { r_a += std::get<1>(info); }
+                        open_index = k;
+                        max_area = area;
                     }
-                    if (min_distance >= delta) { break; } // even the nearest triangle is too far to reach
                 }
-                // replace the strategy if the divide on z-axis is better than above
-                if (std::abs(l_a - r_a) < std::abs(left_area - right_area))
+                if (open_index == W) { break; }     // all children are leaves
+
+                BoxNode const& child = _boxes[children[open_index]];
+                children[open_index] = child.leftchild();
+                children[n_children++] = child.rightchild();
+            }
+
+            for (u32 k = 0; k < n_children; k++)
+            {
+                BoxNode const& child = _boxes[children[k]];
+                wide_boxes[wide_index].boxes.box(k, child.box);
+                if (child.isleaf())
                 {
-                    strategy = DividingStrategy::Z;
-                    divide_line = d_l;
-                    left_area = l_a; right_area = r_a;
+                    wide_boxes[wide_index].index_l[k] = child.index_l;
+                    wide_boxes[wide_index].index_r[k] = child.index_r;
                 }
-
-                // divide this box in halves if the divide strategy success
-                if ((left_area > consts<fg>::eps) && (right_area > consts<fg>::eps))
+                else
                 {
-                    auto strategy_axis = [strategy] (vec3g const& center) noexcept -> fg
-                    {
-                        switch (strategy)
-                        {
-                            case DividingStrategy::X:
-                                return center.x;
-                            case DividingStrategy::Y:
-                                return center.y;
-                            case DividingStrategy::Z:
-                                return center.z;
-                        }
-                    };
+                    u32 const new_index = wide_boxes.size();
+                    wide_boxes.emplace_back();
+                    wide_boxes[wide_index].index_l[k] = new_index;
+                    wide_boxes[wide_index].index_r[k] = 0;
+                    to_collapse.emplace_back(children[k], new_index);
+                }
+            }
+        }
+    }
 
-                    constexpr u32 invalid_index = std::numeric_limits<u32>::max();
-                    // swap triangles to left part and right part
-                    u32 right_start = invalid_index;
-                    for (u32 index = face_start; index < face_stop; index++)
-                    {
-                        if (strategy_axis(std::get<0>(center_areas[index])) < divide_line)
-                        {
-                            if (right_start != invalid_index)
-                            {
-                                std::swap(       _faces[right_start],      _faces[index]);
-                                std::swap(_face_normals[right_start], _face_normals[index]);
-                                std::swap( _face_consts[right_start],  _face_consts[index]);
-                                std::swap( center_areas[right_start],  center_areas[index]);
-                                right_start++;
-                            }
-                        }
-                        else if (right_start == invalid_index)
-                        {
-                            right_start = index;
-                        }
-                    }
+    // copy the triangles of each leaf into `W`-wide packs, the packs of a leaf are contiguous & leaves are in the order of `_boxes`.
+    // the leaves then refer to their first packs instead of triangles, so it must be done before collapsing the hierarchy
+    template<u32 W> void _build_wide_triangles(MappedArray<WideTriangle<W>> & wide_triangles)
+    {
+        wide_triangles.clear();
+        for (BoxNode & box_node : _boxes)
+        {
+            if (!box_node.isleaf()) { continue; }
+            u32 const face_start = box_node.triangle_start();
+            box_node.index_l = wide_triangles.size();
+            for (u32 index = 0; index < box_node.triangles_length(); index++)
+            {
+                if (index % W == 0) { wide_triangles.emplace_back(); }
+                u32 const face_index = face_start + index;
+                indices_t const& vertex_indices = _faces[face_index];
+                wide_triangles.back().triangle(index % W, _vertices[vertex_indices.x], _vertices[vertex_indices.y], _vertices[vertex_indices.z],
+                    _face_normals[face_index], _face_consts[face_index], face_index, triangle_test);
+            }
+        }
+    }
 
-                    // contruct child-boxes
-                    box_node.index_l = box_count++;
-                    box_node.index_r = box_count++;
-                    boxes_depth.emplace_back(box_depth + 1);
-                    boxes_depth.emplace_back(box_depth + 1);
-                    _boxes.emplace_back(_vertices.data(), _faces.data(), face_start, right_start - face_start);
-                    _boxes.emplace_back(_vertices.data(), _faces.data(), right_start, face_stop - right_start);
-                }
+    // the hit time & the coordinates of B & C on face by `triangle_test`, false if the ray misses it before `max_ray_time`.
+    // the arithmetic is the same as `WideTriangle`, `sheared` is the same ray made once for `TriangleTest::Watertight`
+    bool _intersect_face(u32 face_index, Ray const& ray, WatertightRay const& sheared, fg max_ray_time, fg & hit_time, fg & contra_u, fg & contra_v) const noexcept
+    {
+        indices_t const& vertex_indices = _faces[face_index];
+        vec3g const& A = _vertices[vertex_indices.x];
+        vec3g const& B = _vertices[vertex_indices.y];
+        vec3g const& C = _vertices[vertex_indices.z];
+
+        switch (triangle_test)
+        {
+        case TriangleTest::MollerTrumbore:
+        {
+            using L = lanes::Scalar;
+            vec3g const AB = B - A, AC = C - A;
+            vec3g const p = L::cross(ray.direction, AC);
+            fg const det = L::dot(AB, p);
+            vec3g const s = ray.origin - A;
+            vec3g const q = L::cross(s, AB);
+            fg const u = L::dot(s, p), v = L::dot(ray.direction, q);
+            // triangle cannot be seen from behind, the comparisons are also the same as `WideTriangle` for NaN
+            if (!((det > 0) && (u >= 0) && (v >= 0) && (det >= u + v))) { return false; }
+
+            fg const inv_det = 1 / det;
+            hit_time = L::dot(AC, q) * inv_det;
+            if (!((hit_time >= consts<fg>::eps) && (hit_time < max_ray_time))) { return false; }
+            contra_u = u * inv_det;
+            contra_v = v * inv_det;
+            return true;
+        }
+        case TriangleTest::Watertight:
+        {
+            vec3g const a = A - sheared.origin, b = B - sheared.origin, c = C - sheared.origin;
+            fg const ax = a[sheared.kx] - sheared.shear_x * a[sheared.kz], ay = a[sheared.ky] - sheared.shear_y * a[sheared.kz];
+            fg const bx = b[sheared.kx] - sheared.shear_x * b[sheared.kz], by = b[sheared.ky] - sheared.shear_y * b[sheared.kz];
+            fg const cx = c[sheared.kx] - sheared.shear_x * c[sheared.kz], cy = c[sheared.ky] - sheared.shear_y * c[sheared.kz];
+
+            // in double precision, so that the sign is exact & the shared edges of faces get exactly opposite values
+            fg const U = static_cast<fg>(f64(cx) * f64(by) - f64(cy) * f64(bx));
+            fg const V = static_cast<fg>(f64(ax) * f64(cy) - f64(ay) * f64(cx));
+            fg const W = static_cast<fg>(f64(bx) * f64(ay) - f64(by) * f64(ax));
+            // edges are included, triangle cannot be seen from behind
+            fg const det = U + V + W;
+            if ((U < 0) || (V < 0) || (W < 0) || !(det > 0)) { return false; }
+
+            fg const T = U * (sheared.shear_z * a[sheared.kz]) + V * (sheared.shear_z * b[sheared.kz]) + W * (sheared.shear_z * c[sheared.kz]);
+            fg const inv_det = 1 / det;
+            hit_time = T * inv_det;
+            if ((hit_time < consts<fg>::eps) || (hit_time >= max_ray_time)) { return false; }
+            contra_u = V * inv_det;
+            contra_v = W * inv_det;
+            return true;
+        }
+        default:
+        {
+            normal3g const& face_normal = _face_normals[face_index];
+            vec3g const& face_constants = _face_consts[face_index];
+
+            fg d_dot_n = dot(ray.direction, face_normal);
+            // triangle cannot be seen from behind, may be deprecated this line
+            if (d_dot_n >= 0) { return false; }
+
+            hit_time = dot(A - ray.origin, face_normal) / d_dot_n;
+            if ((hit_time < consts<fg>::eps) || (hit_time >= max_ray_time)) { return false; }
+
+            vec3g hit_point = ray.at(hit_time);
+            vec3g coord_point = hit_point - A;
+            fg co_u = dot(coord_point, B - A), co_v = dot(coord_point, C - A);
+            contra_u = co_u * face_constants.z - co_v * face_constants.y;
+            contra_v = co_v * face_constants.x - co_u * face_constants.y;
+            fg contra_w = 1 - contra_u - contra_v;
+            return (contra_u > 0) && (contra_v > 0) && (contra_w > 0);
+        }
+        }
+    }
+
+    // the rounding errors of box tests may miss the rays through vertices & edges on the bounds, so the time of leaving boxes
+    // is scaled conservatively for the tests including edges, as Ize's robust BVH traversal
+    fg _box_time_out_scale() const noexcept
+    {
+        constexpr fg unit_roundoff = std::numeric_limits<fg>::epsilon() / 2;
+        constexpr fg gamma3 = 3 * unit_roundoff / (1 - 3 * unit_roundoff);
+        return (triangle_test != TriangleTest::Projection) ? 1 + 2 * gamma3 : 1;
+    }
+
+    // fill `rec` with the hit on face, which is found by `trace_face` or the wide triangles
+    void _record_hit(u32 face_index, Ray const& ray, fg hit_time, fg contra_u, fg contra_v, TraceRecord & rec) const noexcept
+    {
+        indices_t const& vertex_indices = _faces[face_index];
+        normal3g const& face_normal = _face_normals[face_index];
+        vec3g const& face_constants = _face_consts[face_index];
+
+        rec.max_ray_time = hit_time;
+        rec.hit_point = ray.at(hit_time);
+        rec.face_normal = face_normal;
+        rec.hit_normal = face_normal;
+        rec.hit_face = vec2g(contra_u, contra_v);
+        rec.hit_texture = trinterpolate(_vertex_uv.data(), vertex_indices, rec.hit_face);
+        {
+            // the ratio of areas in texture & world space, where `1 / det` is the squared area in world space
+            vec2g const uv_ab = _vertex_uv[vertex_indices.y] - _vertex_uv[vertex_indices.x];
+            vec2g const uv_ac = _vertex_uv[vertex_indices.z] - _vertex_uv[vertex_indices.x];
+            fg const uv_area = std::abs(uv_ab.x * uv_ac.y - uv_ac.x * uv_ab.y);
+            fg const det = face_constants.x * face_constants.z - sqr(face_constants.y);
+            rec.hit_texture_scale = std::sqrt(uv_area * std::sqrt(std::max(det, fg(0))));
+        }
+        if (enable_normal_interpolation)
+        {
+            rec.hit_normal = trinterpolate(_vertex_normals.data(), vertex_indices, rec.hit_face);
+        }
+    }
+
+    template<u32 W> bool _trace_leaf_wide(MappedArray<WideTriangle<W>> const& wide_triangles, u32 pack_start, u32 n_faces, Ray const& ray, WatertightRay const& sheared, TraceRecord & rec) const noexcept
+    {
+        WideTriangle<W> const* pack = wide_triangles.data() + pack_start;
+        WideTriangle<W> const* stop = pack + (n_faces + W - 1) / W;
+
+        alignas(sizeof(fg) * W) fg times[W], us[W], vs[W];
+        WideTriangle<W> const* hit_pack = nullptr;
+        u32 hit_k = 0;
+        fg hit_u = 0, hit_v = 0;
+        for (; pack < stop; pack++)
+        {
+            // the nearest hit in pack, or the first one if some are equally near like `trace_face` in order
+            for (u32 mask = pack->trace(triangle_test, ray, sheared, rec.max_ray_time, times, us, vs); mask != 0; mask &= mask - 1)
+            {
+                u32 k = std::countr_zero(mask);
+                if (times[k] >= rec.max_ray_time) { continue; }
+                rec.max_ray_time = times[k];
+                hit_pack = pack; hit_k = k;
+                hit_u = us[k]; hit_v = vs[k];
+            }
+        }
+        if (hit_pack == nullptr) { return false; }
+        _record_hit(hit_pack->face[hit_k], ray, rec.max_ray_time, hit_u, hit_v, rec);
+        return true;
+    }
+
+    // `leaf_start` is the first face of leaf, or its first pack if wide triangles are built
+    bool _trace_leaf(u32 leaf_start, u32 n_faces, Ray const& ray, WatertightRay const& sheared, TraceRecord & rec) const noexcept
+    {
+#ifdef NYASRT_SHOW_TRACE_INFO
+        rec.triangle_count += n_faces;
+#endif
+        if (!_wide8_triangles.empty()) { return _trace_leaf_wide(_wide8_triangles, leaf_start, n_faces, ray, sheared, rec); }
+        if (!_wide4_triangles.empty()) { return _trace_leaf_wide(_wide4_triangles, leaf_start, n_faces, ray, sheared, rec); }
+
+        bool hit = false;
+        fg hit_time, contra_u, contra_v;
+        for (u32 face_index = leaf_start; face_index < leaf_start + n_faces; face_index++)
+        {
+            if (!_intersect_face(face_index, ray, sheared, rec.max_ray_time, hit_time, contra_u, contra_v)) { continue; }
+            _record_hit(face_index, ray, hit_time, contra_u, contra_v, rec);
+            hit = true;
+        }
+        return hit;
+    }
+
+    template<u32 W> bool _test_hit_leaf_wide(MappedArray<WideTriangle<W>> const& wide_triangles, u32 pack_start, u32 n_faces, Ray const& ray, WatertightRay const& sheared, fg max_ray_time) const noexcept
+    {
+        WideTriangle<W> const* pack = wide_triangles.data() + pack_start;
+        WideTriangle<W> const* stop = pack + (n_faces + W - 1) / W;
+
+        alignas(sizeof(fg) * W) fg times[W], us[W], vs[W];
+        for (; pack < stop; pack++)
+        {
+            if (pack->trace(triangle_test, ray, sheared, max_ray_time, times, us, vs) != 0) { return true; }
+        }
+        return false;
+    }
+
+    bool _test_hit_leaf(u32 leaf_start, u32 n_faces, Ray const& ray, WatertightRay const& sheared, fg max_ray_time) const noexcept
+    {
+        if (!_wide8_triangles.empty()) { return _test_hit_leaf_wide(_wide8_triangles, leaf_start, n_faces, ray, sheared, max_ray_time); }
+        if (!_wide4_triangles.empty()) { return _test_hit_leaf_wide(_wide4_triangles, leaf_start, n_faces, ray, sheared, max_ray_time); }
+
+        fg hit_time, contra_u, contra_v;
+        for (u32 face_index = leaf_start; face_index < leaf_start + n_faces; face_index++)
+        {
+            if (_intersect_face(face_index, ray, sheared, max_ray_time, hit_time, contra_u, contra_v)) { return true; }
+        }
+        return false;
+    }
+
+    template<u32 W> bool _trace_wide(MappedArray<WideBoxNode<W>> const& wide_boxes, Ray const& ray, TraceRecord & rec) const noexcept
+    {
+        vec3g const inv_d = fg(1) / ray.direction;
+        WatertightRay const sheared(ray);
+
+        // the stack contains both wide nodes and leaves, in the same form of `index_l` and `index_r`
+        using StackEltype = std::tuple<u32 /* index_l */, u32 /* index_r */, fg /* time_in */>;
+        StackEltype to_trace_boxes[max_boxes_depth * (W - 1) + 2];
+        StackEltype * box_p = to_trace_boxes;
+        *box_p = {0, 0, -consts<fg>::inf};
+
+        alignas(sizeof(fg) * W) fg times_in[W];
+        bool hit = false;
+        while (box_p >= to_trace_boxes)
+        {
+            auto [index_l, index_r, time_in] = *(box_p--);
+            if (time_in >= rec.max_ray_time) { continue; }
+
+            if ((index_r & BoxNode::leafbit) != 0)
+            {
+                hit |= _trace_leaf(index_l, index_r & (~BoxNode::leafbit), ray, sheared, rec);
+                continue;
+            }
+
+            WideBoxNode<W> const& wide_node = wide_boxes[index_l];
+            u32 mask = wide_node.boxes.trace(ray, inv_d, rec.max_ray_time, times_in, _box_time_out_scale());
+#ifdef NYASRT_SHOW_TRACE_INFO
+            rec.box_count += W;
+#endif
+
+            // push hit children so that the nearest one is on the top of stack
+            StackEltype * const first = box_p + 1;
+            for (; mask != 0; mask &= mask - 1)
+            {
+                u32 k = std::countr_zero(mask);
+                StackEltype * p = ++box_p;
+                for (; (p > first) && (std::get<2>(*(p - 1)) < times_in[k]); p--) { *p = *(p - 1); }
+                *p = {wide_node.index_l[k], wide_node.index_r[k], times_in[k]};
             }
         }
+        return hit;
     }
 
-    std::vector<BoxNode> _boxes;
-    std::vector<vec3g> _vertices;
-    std::vector<vec3g> _vertex_normals;
-    std::vector<vec2g> _vertex_uv;  // texture coordinate
-    std::vector<indices_t>  _faces;
-    std::vector<normal3g>   _face_normals;
-    std::vector<vec3g>      _face_consts;
+    template<u32 W> bool _test_hit_wide(MappedArray<WideBoxNode<W>> const& wide_boxes, Ray const& ray, fg max_ray_time) const noexcept
+    {
+        vec3g const inv_d = fg(1) / ray.direction;
+        WatertightRay const sheared(ray);
+
+        using StackEltype = std::tuple<u32 /* index_l */, u32 /* index_r */>;
+        StackEltype to_trace_boxes[max_boxes_depth * (W - 1) + 2];
+        StackEltype * box_p = to_trace_boxes;
+        *box_p = {0, 0};
+
+        alignas(sizeof(fg) * W) fg times_in[W];
+        while (box_p >= to_trace_boxes)
+        {
+            auto [index_l, index_r] = *(box_p--);
+
+            if ((index_r & BoxNode::leafbit) != 0)
+            {
+                if (_test_hit_leaf(index_l, index_r & (~BoxNode::leafbit), ray, sheared, max_ray_time)) { return true; }
+                continue;
+            }
+
+            WideBoxNode<W> const& wide_node = wide_boxes[index_l];
+            for (u32 mask = wide_node.boxes.trace(ray, inv_d, max_ray_time, times_in, _box_time_out_scale()); mask != 0; mask &= mask - 1)
+            {
+                u32 k = std::countr_zero(mask);
+                *(++box_p) = {wide_node.index_l[k], wide_node.index_r[k]};
+            }
+        }
+        return false;
+    }
+
+    // the arrays are either owned or viewing a mapped file of prepared mesh
+    MappedArray<BoxNode> _boxes;
+    MappedArray<WideBoxNode<4>> _wide4_boxes;
+    MappedArray<WideBoxNode<8>> _wide8_boxes;
+    MappedArray<vec3g> _vertices;
+    MappedArray<vec3g> _vertex_normals;
+    MappedArray<vec2g> _vertex_uv;  // texture coordinate
+    MappedArray<indices_t>  _faces;
+    MappedArray<normal3g>   _face_normals;
+    MappedArray<vec3g>      _face_consts;
+    MappedArray<WideTriangle<4>> _wide4_triangles;
+    MappedArray<WideTriangle<8>> _wide8_triangles;
+    std::shared_ptr<MappedFile> _mapped_p;
 
 public:
 
+    // the way to divide boxes when building bounding volume hierarchy
+    enum class BVHBuilder : u8
+    {
+        AreaBalancing,          // divide boxes so that each halves have almost the same area
+        SurfaceAreaHeuristic,   // divide boxes to minimize the cost of tracing rays
+    };
+
     bool enable_normal_interpolation;
     bool custom_vertex_normals; // if true, `vertex_normals` must be set by user, otherwise the behavior is undefined
     bool prepared;
+    BVHBuilder bvh_builder;
+    u32 n_prepare_threads;  // the number of threads used in `prepare`, the result is the same for any number of threads
+    u32 bvh_width;          // the number of children in each box, can be 2, 4 or 8. wider boxes are traced with SIMD instructions
+    u32 leaf_width;         // the number of triangles tested at once in leaves, can be 1, 4 or 8. if wider, the triangles are
+                            // copied into packs in BVH order with precomputed edges, costing about 16 times the memory of faces
+    TriangleTest triangle_test; // the ray-triangle intersection test, should be set before `prepare`
 
     Mesh() noexcept
-    :  enable_normal_interpolation{false}, custom_vertex_normals{false}, prepared{false} {}
+    :  enable_normal_interpolation{false}, custom_vertex_normals{false}, prepared{false}, bvh_builder{BVHBuilder::SurfaceAreaHeuristic}
+    , n_prepare_threads{std::max(1u, std::thread::hardware_concurrency())}, bvh_width{2}, leaf_width{1}, triangle_test{TriangleTest::Projection} {}
 
 
     bool prepare()
@@ -291,42 +929,60 @@ public:
         _face_normals.resize(_faces.size());
         _face_consts.resize(_faces.size());
 
-        bool build_vertex_normals = enable_normal_interpolation && !custom_vertex_normals;
-        if (build_vertex_normals) for (normal3g & normal : _vertex_normals) { normal = consts<vec3g>::O; }
-
         u64 const nv = _vertices.size();
-        for (u32 face_index = 0; face_index < _faces.size(); face_index++)
+        std::atomic<bool> indices_in_range{true};
+        parallel_for(n_prepare_threads, (_faces.size() + prepare_chunk_size - 1) / prepare_chunk_size, [&] (u64 chunk)
         {
-            indices_t const& vertex_indices = _faces[face_index];
-            normal3g & face_normal = _face_normals[face_index];
-            vec3g & face_constants = _face_consts[face_index];
-
-            // calculate face normal and some canstants
-            if (vertex_indices.x < nv && vertex_indices.y < nv && vertex_indices.z < nv)
+            u64 const stop = std::min<u64>((chunk + 1) * prepare_chunk_size, _faces.size());
+            for (u64 face_index = chunk * prepare_chunk_size; face_index < stop; face_index++)
             {
-                vec3g const& A = _vertices[vertex_indices.x];
-                vec3g const& B = _vertices[vertex_indices.y];
-                vec3g const& C = _vertices[vertex_indices.z];
+                indices_t const& vertex_indices = _faces[face_index];
+                normal3g & face_normal = _face_normals[face_index];
+                vec3g & face_constants = _face_consts[face_index];
+
+                // calculate face normal and some canstants
+                if (vertex_indices.x < nv && vertex_indices.y < nv && vertex_indices.z < nv)
+                {
+                    vec3g const& A = _vertices[vertex_indices.x];
+                    vec3g const& B = _vertices[vertex_indices.y];
+                    vec3g const& C = _vertices[vertex_indices.z];
 
-                face_normal = normalize(cross(B - A, C - A));
+                    face_normal = normalize(cross(B - A, C - A));
 
-                face_constants.x = dot(B - A, B - A);
-                face_constants.y = dot(B - A, C - A);
-                face_constants.z = dot(C - A, C - A);
-                fg inv_det = 1 / (face_constants.x * face_constants.z - sqr(face_constants.y));
-                face_constants *= inv_det;
+                    face_constants.x = dot(B - A, B - A);
+                    face_constants.y = dot(B - A, C - A);
+                    face_constants.z = dot(C - A, C - A);
+                    fg inv_det = 1 / (face_constants.x * face_constants.z - sqr(face_constants.y));
+                    face_constants *= inv_det;
+                }
+                else { indices_in_range.store(false, std::memory_order_relaxed); }
             }
-            else { return false; }      // vertex index out of range
-            if (build_vertex_normals)
+        });
+        if (!indices_in_range) { return false; }    // vertex index out of range
+
+        // vertex normals are accumulated in serial, so that the result is independent of threads
+        if (enable_normal_interpolation && !custom_vertex_normals)
+        {
+            for (normal3g & normal : _vertex_normals) { normal = consts<vec3g>::O; }
+            for (u32 face_index = 0; face_index < _faces.size(); face_index++)
             {
-                _vertex_normals[vertex_indices.x] += face_normal;
-                _vertex_normals[vertex_indices.y] += face_normal;
-                _vertex_normals[vertex_indices.z] += face_normal;
+                indices_t const& vertex_indices = _faces[face_index];
+                _vertex_normals[vertex_indices.x] += _face_normals[face_index];
+                _vertex_normals[vertex_indices.y] += _face_normals[face_index];
+                _vertex_normals[vertex_indices.z] += _face_normals[face_index];
             }
         }
         if (enable_normal_interpolation) for (normal3g & normal : _vertex_normals) { normal = normalize(normal); }
 
         _build_bounding_volume_hierarchy();
+        _wide4_triangles.clear();
+        _wide8_triangles.clear();
+        if (leaf_width == 4) { _build_wide_triangles(_wide4_triangles); }
+        if (leaf_width == 8) { _build_wide_triangles(_wide8_triangles); }
+        _wide4_boxes.clear();
+        _wide8_boxes.clear();
+        if (bvh_width == 4) { _collapse_bounding_volume_hierarchy(_wide4_boxes); }
+        if (bvh_width == 8) { _collapse_bounding_volume_hierarchy(_wide8_boxes); }
 
 #ifdef NYASRT_SHOW_TRACE_INFO
         std::cout << "# of triangles: " << _faces.size() << ", # of boxes: " << _boxes.size() << std::endl;
@@ -408,6 +1064,20 @@ public:
     {
         return _faces[index];
     }
+    u32 n_vertices() const noexcept
+    {
+        return _vertices.size();
+    }
+    u32 n_faces() const noexcept
+    {
+        return _faces.size();
+    }
+
+    // the bounding box of the whole mesh in model space, only valid after prepared
+    BoundingBox bounding_box() const noexcept
+    {
+        return _boxes.empty() ? BoundingBox() : _boxes.front().box;
+    }
 
     /******** mesh trasformations ********/
 
@@ -421,54 +1091,138 @@ public:
         return *this;
     }
 
+    // split each triangle into `subdivision ^ 2` triangles, the new vertices on an edge are shared by faces of the edge,
+    // the attributes of new vertices are interpolated linearly. done in parallel by `n_prepare_threads`
     Mesh & subdivise(u32 subdivision = 2)
     {
         if (subdivision < 2) { return *this; }
         prepared = false;
 
-        // TODO: share the new vertices belong the edges
-        std::vector<vec3g> new_vertices;
-        std::vector<vec3g> new_vertex_normals;
-        std::vector<vec2g> new_vertex_uv;  // texture coordinate
-        std::vector<indices_t> new_faces;
-        new_vertices.reserve(_faces.size() * (((subdivision + 1) * (subdivision + 2)) >> 1));
-        new_vertex_normals.reserve(new_vertices.size());
-        new_vertex_uv.reserve(new_vertices.size());
-        new_faces.reserve(_faces.size() * sqr(subdivision));
-        // TODO: vertex normals
-
-        u32 v_index = 0;
+        u32 const n = subdivision;
+        u64 const n_vertices = _vertices.size(), n_faces = _faces.size();
+        u64 const n_chunks = (n_faces + prepare_chunk_size - 1) / prepare_chunk_size;
+
+        // the edges are grouped by their smaller vertex, the larger ones are sorted in each group
+        std::vector<u64> groups(n_vertices + 1, 0);
+        for (indices_t const& vertex_indices : _faces)
+        {
+            groups[std::min(vertex_indices.x, vertex_indices.y) + 1]++;
+            groups[std::min(vertex_indices.y, vertex_indices.z) + 1]++;
+            groups[std::min(vertex_indices.z, vertex_indices.x) + 1]++;
+        }
+        std::partial_sum(groups.begin(), groups.end(), groups.begin());
+        std::vector<u32> ends(groups.begin(), groups.end() - 1), others(3 * n_faces);
         for (indices_t const& vertex_indices : _faces)
         {
-            for (u32 v_i = 0; v_i <= subdivision; v_i++)
+            others[ends[std::min(vertex_indices.x, vertex_indices.y)]++] = std::max(vertex_indices.x, vertex_indices.y);
+            others[ends[std::min(vertex_indices.y, vertex_indices.z)]++] = std::max(vertex_indices.y, vertex_indices.z);
+            others[ends[std::min(vertex_indices.z, vertex_indices.x)]++] = std::max(vertex_indices.z, vertex_indices.x);
+        }
+        std::vector<u64> first_edges(n_vertices + 1, 0);    // the index of first edge of each group
+        parallel_for(n_prepare_threads, (n_vertices + prepare_chunk_size - 1) / prepare_chunk_size, [&] (u64 chunk)
+        {
+            u64 const stop = std::min<u64>((chunk + 1) * prepare_chunk_size, n_vertices);
+            for (u64 v = chunk * prepare_chunk_size; v < stop; v++)
             {
-                for (u32 u_i = 0; u_i <= subdivision - v_i; u_i++)
+                std::sort(others.begin() + groups[v], others.begin() + groups[v + 1]);
+                ends[v] = std::unique(others.begin() + groups[v], others.begin() + groups[v + 1]) - others.begin();
+                first_edges[v + 1] = ends[v] - groups[v];
+            }
+        });
+        std::partial_sum(first_edges.begin(), first_edges.end(), first_edges.begin());
+        u64 const n_edges = first_edges.back();
+
+        // new vertices are the old ones, then `n - 1` on each edge, then `(n - 1)(n - 2) / 2` inside each face
+        u64 const n_interior = u64(n - 1) * (n - 2) / 2;
+        u64 const edges_start = n_vertices, interiors_start = edges_start + n_edges * (n - 1);
+        u64 const n_new_vertices = interiors_start + n_faces * n_interior;
+
+        _vertices      .resize(n_new_vertices);
+        _vertex_normals.resize(n_new_vertices);
+        _vertex_uv     .resize(n_new_vertices);
+        std::vector<indices_t> new_faces(n_faces * sqr(n));
+
+        // the vertices on each edge, from the smaller vertex to the larger one
+        parallel_for(n_prepare_threads, (n_vertices + prepare_chunk_size - 1) / prepare_chunk_size, [&] (u64 chunk)
+        {
+            u64 const stop = std::min<u64>((chunk + 1) * prepare_chunk_size, n_vertices);
+            for (u64 low = chunk * prepare_chunk_size; low < stop; low++)
+            {
+                for (u64 k = groups[low]; k < ends[low]; k++)
                 {
-                    vec2g uv = vec2g(u_i, v_i) / fg(subdivision);
-                    new_vertices      .push_back(trinterpolate(_vertices      .data(), vertex_indices, uv));
-                    new_vertex_normals.push_back(trinterpolate(_vertex_normals.data(), vertex_indices, uv));
-                    new_vertex_uv     .push_back(trinterpolate(_vertex_uv     .data(), vertex_indices, uv));
+                    u32 const high = others[k];
+                    u64 const base = edges_start + (first_edges[low] + (k - groups[low])) * (n - 1);
+                    for (u32 step = 1; step < n; step++)
+                    {
+                        fg const t = fg(step) / n;
+                        _vertices      [base + step - 1] = lerp(std::as_const(_vertices)      [low], std::as_const(_vertices)      [high], t);
+                        _vertex_normals[base + step - 1] = lerp(std::as_const(_vertex_normals)[low], std::as_const(_vertex_normals)[high], t);
+                        _vertex_uv     [base + step - 1] = lerp(std::as_const(_vertex_uv)     [low], std::as_const(_vertex_uv)     [high], t);
+                    }
                 }
             }
+        });
+
+        auto edge_index = [&] (u32 a, u32 b) -> u64
+        {
+            u32 const low = std::min(a, b);
+            return first_edges[low] + (std::lower_bound(others.begin() + groups[low], others.begin() + ends[low], std::max(a, b)) - (others.begin() + groups[low]));
+        };
+        // the vertex at `step` of `n` from `a` to `b`
+        auto edge_vertex = [&] (u32 a, u32 b, u32 step) -> u32
+        {
+            u64 const base = edges_start + edge_index(a, b) * (n - 1);
+            return static_cast<u32>((a < b) ? (base + step - 1) : (base + (n - step) - 1));
+        };
 
-            for (u32 v_i = 0; v_i < subdivision; v_i++)
+        parallel_for(n_prepare_threads, n_chunks, [&] (u64 chunk)
+        {
+            u64 const stop = std::min<u64>((chunk + 1) * prepare_chunk_size, n_faces);
+            std::vector<u32> grid(((n + 1) * (n + 2)) / 2);
+            for (u64 face_index = chunk * prepare_chunk_size; face_index < stop; face_index++)
             {
-                new_faces.emplace_back(v_index, v_index + 1, v_index + (subdivision - v_i));
-                v_index++;
-                for (u32 u_i = 1; u_i < subdivision - v_i; u_i++)
+                indices_t const vertex_indices = std::as_const(_faces)[face_index];
+                u64 interior = interiors_start + face_index * n_interior;
+
+                // the vertex of each grid point `(u, v)` in rows of `v`
+                u32 * point = grid.data();
+                for (u32 v_i = 0; v_i <= n; v_i++)
                 {
-                    new_faces.emplace_back(v_index, v_index + 1, v_index + (subdivision - v_i));
-                    new_faces.emplace_back(v_index, v_index + (subdivision - v_i), (v_index - 1) + (subdivision - v_i));
-                    v_index++;
+                    for (u32 u_i = 0; u_i <= n - v_i; u_i++, point++)
+                    {
+                        if      ((u_i == 0) && (v_i == 0)) { *point = vertex_indices.x; }
+                        else if (u_i == n)                 { *point = vertex_indices.y; }
+                        else if (v_i == n)                 { *point = vertex_indices.z; }
+                        else if (v_i == 0)                 { *point = edge_vertex(vertex_indices.x, vertex_indices.y, u_i); }
+                        else if (u_i == 0)                 { *point = edge_vertex(vertex_indices.x, vertex_indices.z, v_i); }
+                        else if (u_i + v_i == n)           { *point = edge_vertex(vertex_indices.y, vertex_indices.z, v_i); }
+                        else
+                        {
+                            *point = static_cast<u32>(interior++);
+                            vec2g const uv = vec2g(u_i, v_i) / fg(n);
+                            _vertices      [*point] = trinterpolate(std::as_const(_vertices)      .data(), vertex_indices, uv);
+                            _vertex_normals[*point] = trinterpolate(std::as_const(_vertex_normals).data(), vertex_indices, uv);
+                            _vertex_uv     [*point] = trinterpolate(std::as_const(_vertex_uv)     .data(), vertex_indices, uv);
+                        }
+                    }
+                }
+
+                // the index of `(u, v + 1)` is `(n + 1 - v)` after `(u, v)`
+                indices_t * face = new_faces.data() + face_index * sqr(n);
+                u32 row = 0;
+                for (u32 v_i = 0; v_i < n; v_i++)
+                {
+                    u32 const next_row = row + (n + 1 - v_i);
+                    for (u32 u_i = 0; u_i < n - v_i; u_i++)
+                    {
+                        *(face++) = indices_t(grid[row + u_i], grid[row + u_i + 1], grid[next_row + u_i]);
+                        if (u_i > 0) { *(face++) = indices_t(grid[row + u_i], grid[next_row + u_i], grid[next_row + u_i - 1]); }
+                    }
+                    row = next_row;
                 }
-                v_index++;
             }
-            v_index++;
-        }
+        });
 
-        _vertices      .swap(new_vertices);
-        _vertex_normals.swap(new_vertex_normals);
-        _vertex_uv     .swap(new_vertex_uv);
         _faces.swap(new_faces);
         return *this;
     }
@@ -478,44 +1232,22 @@ public:
 
     bool trace_face(u32 face_index, Ray const& ray, TraceRecord & rec)  const noexcept
     {
-        indices_t const& vertex_indices = _faces[face_index];
-        normal3g const& face_normal = _face_normals[face_index];
-        vec3g const& face_constants = _face_consts[face_index];
-        vec3g const& A = _vertices[vertex_indices.x];
-        vec3g const& B = _vertices[vertex_indices.y];
-        vec3g const& C = _vertices[vertex_indices.z];
-
-        fg d_dot_n = dot(ray.direction, face_normal);
-        // triangle cannot be seen from behind, may be deprecated this line
-        if (d_dot_n >= 0) { return false; }
-
-        fg hit_time = dot(A - ray.origin, face_normal) / d_dot_n;
-        if ((hit_time < consts<fg>::eps) || (hit_time >= rec.max_ray_time)) { return false; }
-
-        vec3g hit_point = ray.at(hit_time);
-        vec3g coord_point = hit_point - A;
-        fg co_u = dot(coord_point, B - A), co_v = dot(coord_point, C - A);
-        fg contra_u = co_u * face_constants.z - co_v * face_constants.y;
-        fg contra_v = co_v * face_constants.x - co_u * face_constants.y;
-        fg contra_w = 1 - contra_u - contra_v;
-        if ((contra_u <= 0) || (contra_v <= 0) || (contra_w <= 0)) { return false; }
+        fg hit_time, contra_u, contra_v;
+        if (!_intersect_face(face_index, ray, WatertightRay(ray), rec.max_ray_time, hit_time, contra_u, contra_v)) { return false; }
 
-        rec.max_ray_time = hit_time;
-        rec.hit_point = hit_point;
-        rec.face_normal = face_normal;
-        rec.hit_normal = face_normal;
-        rec.hit_face = vec2g(contra_u, contra_v);
-        rec.hit_texture = trinterpolate(_vertex_uv.data(), vertex_indices, rec.hit_face);
-        if (enable_normal_interpolation)
-        {
-            rec.hit_normal = trinterpolate(_vertex_normals.data(), vertex_indices, rec.hit_face);
-        }
+        _record_hit(face_index, ray, hit_time, contra_u, contra_v, rec);
         return true;
     }
 
     bool trace(Ray const& ray, TraceRecord & rec) const noexcept
     {
+        if (!_wide8_boxes.empty()) { return _trace_wide(_wide8_boxes, ray, rec); }
+        if (!_wide4_boxes.empty()) { return _trace_wide(_wide4_boxes, ray, rec); }
+
+        fg const time_out_scale = _box_time_out_scale();
+        WatertightRay const sheared(ray);
         auto [time_in, time_out] = _boxes.front().box.trace(ray);
+        time_out *= time_out_scale;
 #ifdef NYASRT_SHOW_TRACE_INFO
         rec.box_count++;
 #endif
@@ -536,14 +1268,7 @@ public:
 
             if (box_node.isleaf())
             {
-                u32 stop = box_node.triangle_start() + box_node.triangles_length();
-                for (u32 face_index = box_node.triangle_start(); face_index < stop; face_index++)
-                {
-                    hit |= trace_face(face_index, ray, rec);
-#ifdef NYASRT_SHOW_TRACE_INFO
-                    rec.triangle_count++;
-#endif
-                }
+                hit |= _trace_leaf(box_node.triangle_start(), box_node.triangles_length(), ray, sheared, rec);
             }
             else
             {
@@ -552,6 +1277,8 @@ public:
                 BoxNode const* child_r = &_boxes[box_node.rightchild()];
                 auto [in_l, out_l] = child_l->box.trace(ray);
                 auto [in_r, out_r] = child_r->box.trace(ray);
+                out_l *= time_out_scale;
+                out_r *= time_out_scale;
 #ifdef NYASRT_SHOW_TRACE_INFO
                 rec.box_count += 2;
 #endif
@@ -581,34 +1308,19 @@ public:
 
     bool test_hit_face(u32 face_index, Ray const& ray, fg max_ray_time) const noexcept
     {
-        indices_t const& vertex_indices = _faces[face_index];
-        normal3g const& face_normal = _face_normals[face_index];
-        vec3g const& face_constants = _face_consts[face_index];
-        vec3g const& A = _vertices[vertex_indices.x];
-        vec3g const& B = _vertices[vertex_indices.y];
-        vec3g const& C = _vertices[vertex_indices.z];
-
-        fg d_dot_n = dot(ray.direction, face_normal);
-        // triangle cannot be seen from behind, may be deprecated this line
-        if (d_dot_n >= 0) { return false; }
-
-        fg hit_time = dot(A - ray.origin, face_normal) / d_dot_n;
-        if ((hit_time < consts<fg>::eps) || (hit_time >= max_ray_time)) { return false; }
-
-        vec3g hit_point = ray.at(hit_time);
-        vec3g coord_point = hit_point - A;
-        fg co_u = dot(coord_point, B - A), co_v = dot(coord_point, C - A);
-        fg contra_u = co_u * face_constants.z - co_v * face_constants.y;
-        fg contra_v = co_v * face_constants.x - co_u * face_constants.y;
-        fg contra_w = 1 - contra_u - contra_v;
-        if ((contra_u <= 0) || (contra_v <= 0) || (contra_w <= 0)) { return false; }
-
-        return true;
+        fg hit_time, contra_u, contra_v;
+        return _intersect_face(face_index, ray, WatertightRay(ray), max_ray_time, hit_time, contra_u, contra_v);
     }
 
     bool test_hit(Ray const& ray, fg max_ray_time) const noexcept
     {
+        if (!_wide8_boxes.empty()) { return _test_hit_wide(_wide8_boxes, ray, max_ray_time); }
+        if (!_wide4_boxes.empty()) { return _test_hit_wide(_wide4_boxes, ray, max_ray_time); }
+
+        fg const time_out_scale = _box_time_out_scale();
+        WatertightRay const sheared(ray);
         auto [time_in, time_out] = _boxes.front().box.trace(ray);
+        time_out *= time_out_scale;
         if ((time_out < consts<fg>::eps) || (time_in >= time_out)) { return false; }
 
         using StackEltype = std::tuple<BoxNode const* /* box */, fg /* time_in */>;
@@ -625,11 +1337,7 @@ public:
 
             if (box_node.isleaf())
             {
-                u32 stop = box_node.triangle_start() + box_node.triangles_length();
-                for (u32 face_index = box_node.triangle_start(); face_index < stop; face_index++)
-                {
-                    if (test_hit_face(face_index, ray, max_ray_time)) { return true; }
-                }
+                if (_test_hit_leaf(box_node.triangle_start(), box_node.triangles_length(), ray, sheared, max_ray_time)) { return true; }
             }
             else
             {
@@ -638,6 +1346,8 @@ public:
                 BoxNode const* child_r = &_boxes[box_node.rightchild()];
                 auto [in_l, out_l] = child_l->box.trace(ray);
                 auto [in_r, out_r] = child_r->box.trace(ray);
+                out_l *= time_out_scale;
+                out_r *= time_out_scale;
 
                 // push them in to stack (or not)
                 if ((out_r >= consts<fg>::eps) && (in_r < out_r))
@@ -656,12 +1366,101 @@ public:
 
     /******** load obj file ********/
 
-    static MeshPtr load_obj(std::filesystem::path const& path)
+    // the file is mapped into memory & parsed in parallel by `n_threads`
+    static MeshPtr load_obj(std::filesystem::path const& path, u32 n_threads = std::max(1u, std::thread::hardware_concurrency()))
+    {
+        MappedFile file(path, true);
+        if (!file.is_open()) { return std::make_shared<Mesh>(); }
+        return load_obj(file.begin(), file.end(), n_threads);
+    }
+    static MeshPtr load_obj(std::ifstream & file, u32 n_threads = std::max(1u, std::thread::hardware_concurrency()));
+    static MeshPtr load_obj(char const* begin, char const* end, u32 n_threads = std::max(1u, std::thread::hardware_concurrency()));
+
+
+    /******** prepared mesh file ********/
+
+    // save the prepared state, so that it can be mapped back by `load_prepared` without preparing again.
+    // the file is only valid for the same version & build, e.g. the size of `fg` & SIMD layout of boxes
+    bool save_prepared(std::filesystem::path const& path) const
     {
-        std::ifstream file(path);
-        return load_obj(file);
+        if (!prepared) { return false; }
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) { return false; }
+
+        PreparedHeader header = _prepared_header();
+        u32 k = 0;
+        std::apply([&] (auto const&... arrays) { ((header.counts[k++] = arrays.size()), ...); }, _prepared_arrays(*this));
+        file.write(reinterpret_cast<char const*>(&header), sizeof(PreparedHeader));
+
+        u64 offset = sizeof(PreparedHeader);
+        char const zeros[prepared_alignment] = {};
+        auto write = [&] (auto const& array)
+        {
+            u64 const padding = _prepared_align(offset) - offset;
+            u64 const bytes = array.size() * sizeof(*array.data());
+            file.write(zeros, padding);
+            file.write(reinterpret_cast<char const*>(array.data()), bytes);
+            offset += padding + bytes;
+        };
+        std::apply([&] (auto const&... arrays) { (write(arrays), ...); }, _prepared_arrays(*this));
+        return file.good();
+    }
+
+    // map a file saved by `save_prepared` & view the arrays in it without copying, the mesh is prepared then.
+    // the pages are shared by processes mapping the same file. false if the file is not for this version or build,
+    // or if it is corrupted, in which case the mesh is left empty
+    bool load_prepared(std::filesystem::path const& path)
+    {
+        auto mapped_p = std::make_shared<MappedFile>(path);
+        if (!mapped_p->is_open() || (mapped_p->size() < sizeof(PreparedHeader))) { return false; }
+
+        PreparedHeader header;
+        std::memcpy(&header, mapped_p->data(), sizeof(PreparedHeader));
+        PreparedHeader const expected = _prepared_header();
+        if ((header.magic != expected.magic) || (header.version != expected.version)) { return false; }
+        if (!std::equal(std::begin(header.layout), std::end(header.layout), std::begin(expected.layout))) { return false; }
+        if ((header.bvh_width != 2) && (header.bvh_width != 4) && (header.bvh_width != 8)) { return false; }
+        if ((header.leaf_width != 1) && (header.leaf_width != 4) && (header.leaf_width != 8)) { return false; }
+        if (header.triangle_test > static_cast<u32>(TriangleTest::Watertight)) { return false; }
+
+        // check the size before viewing anything, the counts are compared by division so that they cannot overflow
+        u64 const size = mapped_p->size();
+        u64 offsets[n_prepared_arrays];
+        u64 offset = sizeof(PreparedHeader);
+        u32 k = 0;
+        bool in_file = true;
+        auto locate = [&] (auto const& array)
+        {
+            u64 const element_size = sizeof(*array.data());
+            offset = offsets[k] = _prepared_align(offset);
+            if (!in_file || (offset > size) || (header.counts[k] > (size - offset) / element_size)) { in_file = false; return; }
+            offset += header.counts[k++] * element_size;
+        };
+        std::apply([&] (auto const&... arrays) { (locate(arrays), ...); }, _prepared_arrays(std::as_const(*this)));
+        if (!in_file) { return false; }
+
+        k = 0;
+        auto view = [&] (auto & array)
+        {
+            using T = std::remove_cvref_t<decltype(*std::as_const(array).data())>;
+            array.view(reinterpret_cast<T const*>(mapped_p->data() + offsets[k]), header.counts[k]);
+            k++;
+        };
+        std::apply([&] (auto &... arrays) { (view(arrays), ...); }, _prepared_arrays(*this));
+        if (!_prepared_valid(header.bvh_width, header.leaf_width))
+        {
+            std::apply([] (auto &... arrays) { (arrays.clear(), ...); }, _prepared_arrays(*this));
+            return prepared = false;
+        }
+
+        enable_normal_interpolation = (header.flags & 1) != 0;
+        custom_vertex_normals = (header.flags & 2) != 0;
+        bvh_width = header.bvh_width;
+        leaf_width = header.leaf_width;
+        triangle_test = static_cast<TriangleTest>(header.triangle_test);
+        _mapped_p = mapped_p;
+        return prepared = true;
     }
-    static MeshPtr load_obj(std::ifstream & file);
 
 
     /******** mesh generations ********/
@@ -677,37 +1476,72 @@ public:
 };
 
 
-MeshPtr Mesh::load_obj(std::ifstream & file)
+MeshPtr Mesh::load_obj(std::ifstream & file, u32 n_threads)
 {
-    MeshPtr mesh_p = std::make_shared<Mesh>();
-    if (!file.is_open()) { return mesh_p; }
+    if (!file.is_open()) { return std::make_shared<Mesh>(); }
+    std::string text{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    return load_obj(text.data(), text.data() + text.size(), n_threads);
+}
 
-    vec3g v; indices_t v_indeces;
+MeshPtr Mesh::load_obj(char const* begin, char const* end, u32 n_threads)
+{
+    MeshPtr mesh_p = std::make_shared<Mesh>();
+    ObjParser obj;
+    if (!obj.parse(begin, end, n_threads)) { return mesh_p; }
 
-    for (std::string line, part; std::getline(file, line);)
+    // a vertex of mesh for each different `v/vt/vn`, vertices with only `v` are kept as in file
+    bool only_positions = true, all_normals = !obj.corners.empty();
+    for (ObjParser::Corner const& corner : obj.corners)
     {
-        std::stringstream line_buff(line);
-        line_buff >> part;
+        only_positions &= (corner.texture_coordinate < 0) && (corner.normal < 0);
+        all_normals &= corner.normal >= 0;
+    }
 
-        if (part == "v")        // geometric vertix
+    std::vector<u32> vertex_indices(obj.corners.size());
+    if (only_positions)
+    {
+        mesh_p->reserve_vertices(obj.positions.size());
+        for (vec3g const& position : obj.positions) { mesh_p->add_vertex(position); }
+        for (u64 k = 0; k < obj.corners.size(); k++) { vertex_indices[k] = obj.corners[k].position; }
+    }
+    else
+    {
+        // the vertices of the same position are linked, most positions have only a few
+        std::vector<i32> first(obj.positions.size(), -1), next, texture_coordinates, normals;
+        for (u64 k = 0; k < obj.corners.size(); k++)
         {
-            line_buff >> part; v.x =  s2n<fg>(part);
-            line_buff >> part; v.z =  s2n<fg>(part);
-            line_buff >> part; v.y = -s2n<fg>(part);
-            // should left nothing in `line_buff`
-            mesh_p->add_vertex(v);
+            ObjParser::Corner const& corner = obj.corners[k];
+            i32 index = first[corner.position];
+            while ((index >= 0) && !((texture_coordinates[index] == corner.texture_coordinate) && (normals[index] == corner.normal))) { index = next[index]; }
+            if (index < 0)
+            {
+                VertexInfo vertex;
+                vertex.position           = obj.positions[corner.position];
+                vertex.texture_coordinate = (corner.texture_coordinate >= 0) ? obj.texture_coordinates[corner.texture_coordinate] : consts<vec2g>::O;
+                vertex.normal             = (corner.normal >= 0) ? obj.normals[corner.normal] : consts<vec3g>::Z;
+                index = mesh_p->add_vertex(vertex);
+                next.push_back(first[corner.position]);
+                texture_coordinates.push_back(corner.texture_coordinate);
+                normals.push_back(corner.normal);
+                first[corner.position] = index;
+            }
+            vertex_indices[k] = index;
         }
-        else if (part == "f")   // polygonal face element
+    }
+    // the normals in file are used if every vertex has one
+    mesh_p->custom_vertex_normals = all_normals;
+
+    // split polygons to triangles as fans, which is right for convex polygons
+    u64 n_triangles = 0;
+    for (u64 f = 0; f + 1 < obj.polygons.size(); f++) { n_triangles += std::max<u64>(obj.polygons[f + 1] - obj.polygons[f], 2) - 2; }
+    mesh_p->reserve_faces(n_triangles);
+    for (u64 f = 0; f + 1 < obj.polygons.size(); f++)
+    {
+        for (u64 k = obj.polygons[f] + 2; k < obj.polygons[f + 1]; k++)
         {
-            line_buff >> part; v_indeces.x = s2n<u32>(part);
-            line_buff >> part; v_indeces.y = s2n<u32>(part);
-            line_buff >> part; v_indeces.z = s2n<u32>(part);
-            // TODO: support many indces `.../.../...`
-            // TODO: slpit polygon to triangles
-            mesh_p->add_face(v_indeces - indices_t(1));
+            mesh_p->add_face(vertex_indices[obj.polygons[f]], vertex_indices[k - 1], vertex_indices[k]);
         }
     }
-
     return mesh_p;
 }
 
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <vector>
+
+#include "../common.hpp"
+
+
+namespace nyasRT
+{
+// parse the geometry of wavefront obj files, text is split into chunks at line breaks & parsed in parallel,
+// then chunks are merged in order. only `v`, `vt`, `vn` & `f` are read, other statements are ignored.
+// the positions & normals are converted from y-up to z-up
+class ObjParser final
+{
+public:
+
+    // 0-based indices of a corner of polygon, -1 if absent
+    class Corner
+    {
+    public:
+
+        i32 position, texture_coordinate, normal;
+    };
+
+    std::vector<vec3g> positions;
+    std::vector<vec2g> texture_coordinates;
+    std::vector<vec3g> normals;
+    std::vector<Corner> corners;
+    std::vector<u64> polygons;  // the first corner of each polygon, `n_polygons + 1` elements
+
+private:
+
+    // the elements in a chunk of lines, corners are kept as written
+    class Chunk
+    {
+    public:
+
+        std::vector<vec3g> positions;
+        std::vector<vec2g> texture_coordinates;
+        std::vector<vec3g> normals;
+        std::vector<Corner> corners;
+        std::vector<u32> polygons;          // the number of corners of each polygon
+        std::vector<Corner> counts;         // the number of elements before each polygon in this chunk, for relative indices
+        bool failed = false;
+
+        Corner offsets;                     // the number of elements before this chunk
+        u64 corner_offset, polygon_offset;
+    };
+
+    static constexpr u64 chunk_size = 1 << 20;
+
+    static inline char const* _skip_spaces(char const* p, char const* end) noexcept
+    {
+        while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r'))) { p++; }
+        return p;
+    }
+    template<class T> static inline char const* _number(char const* p, char const* end, T & value) noexcept
+    {
+        p = _skip_spaces(p, end);
+        if ((p < end) && (*p == '+')) { p++; }
+        auto const [stop, error] = std::from_chars(p, end, value);
+        return (error == std::errc{}) ? stop : nullptr;
+    }
+
+    static void _parse(char const* p, char const* end, Chunk & chunk)
+    {
+        while (p < end)
+        {
+            char const* line_end = static_cast<char const*>(std::memchr(p, '\n', end - p));
+            if (line_end == nullptr) { line_end = end; }
+            char const* const next_line = line_end + 1;
+            // a comment may follow the data on the same line
+            if (char const* comment = static_cast<char const*>(std::memchr(p, '#', line_end - p))) { line_end = comment; }
+            p = _skip_spaces(p, line_end);
+
+            if ((line_end - p > 2) && (p[0] == 'v') && ((p[1] == ' ') || (p[1] == '\t')))         // geometric vertex
+            {
+                vec3g v;
+                if (!((p = _number(p + 1, line_end, v.x)) && (p = _number(p, line_end, v.y)) && (p = _number(p, line_end, v.z)))) { chunk.failed = true; return; }
+                chunk.positions.emplace_back(v.x, -v.z, v.y);
+            }
+            else if ((line_end - p > 3) && (p[0] == 'v') && (p[1] == 't'))                         // texture coordinate
+            {
+                vec2g vt(0);
+                if (!(p = _number(p + 2, line_end, vt.x))) { chunk.failed = true; return; }
+                _number(p, line_end, vt.y);     // `v` is optional
+                chunk.texture_coordinates.emplace_back(vt);
+            }
+            else if ((line_end - p > 3) && (p[0] == 'v') && (p[1] == 'n'))                         // vertex normal
+            {
+                vec3g vn;
+                if (!((p = _number(p + 2, line_end, vn.x)) && (p = _number(p, line_end, vn.y)) && (p = _number(p, line_end, vn.z)))) { chunk.failed = true; return; }
+                chunk.normals.emplace_back(vn.x, -vn.z, vn.y);
+            }
+            else if ((line_end - p > 2) && (p[0] == 'f') && ((p[1] == ' ') || (p[1] == '\t')))    // polygonal face element, `v`, `v/vt`, `v//vn` or `v/vt/vn`
+            {
+                u32 n = 0;
+                for (p = _skip_spaces(p + 1, line_end); p < line_end; p = _skip_spaces(p, line_end), n++)
+                {
+                    Corner corner{0, 0, 0};
+                    if (!(p = _number(p, line_end, corner.position))) { chunk.failed = true; return; }
+                    if ((p < line_end) && (*p == '/'))
+                    {
+                        if ((++p < line_end) && (*p != '/') && !(p = _number(p, line_end, corner.texture_coordinate))) { chunk.failed = true; return; }
+                        if ((p < line_end) && (*p == '/') && !(p = _number(p + 1, line_end, corner.normal))) { chunk.failed = true; return; }
+                    }
+                    chunk.corners.push_back(corner);
+                }
+                chunk.polygons.push_back(n);
+                chunk.counts.push_back({i32(chunk.positions.size()), i32(chunk.texture_coordinates.size()), i32(chunk.normals.size())});
+            }
+            p = next_line;
+        }
+    }
+
+    // to 0-based index, `count` is the number of elements before in file
+    static inline i32 _resolve(i32 index, i32 count, u64 total, bool & failed) noexcept
+    {
+        if (index == 0) { return -1; }
+        index = (index > 0) ? (index - 1) : (count + index);
+        if ((index < 0) || (u64(index) >= total)) { failed = true; return -1; }
+        return index;
+    }
+
+public:
+
+    bool parse(char const* begin, char const* end, u32 n_threads)
+    {
+        positions.clear(); texture_coordinates.clear(); normals.clear(); corners.clear(); polygons.clear();
+
+        // split at line breaks
+        std::vector<char const*> starts{begin};
+        while (end - starts.back() > i64(chunk_size))
+        {
+            char const* p = static_cast<char const*>(std::memchr(starts.back() + chunk_size, '\n', end - starts.back() - chunk_size));
+            if (p == nullptr) { break; }
+            starts.push_back(p + 1);
+        }
+        starts.push_back(end);
+
+        std::vector<Chunk> chunks(starts.size() - 1);
+        parallel_for(n_threads, chunks.size(), [&] (u64 k) { _parse(starts[k], starts[k + 1], chunks[k]); });
+
+        Corner total{0, 0, 0};
+        u64 n_corners = 0, n_polygons = 0;
+        for (Chunk & chunk : chunks)
+        {
+            if (chunk.failed) { return false; }
+            chunk.offsets = total; chunk.corner_offset = n_corners; chunk.polygon_offset = n_polygons;
+            total.position += chunk.positions.size(); total.texture_coordinate += chunk.texture_coordinates.size(); total.normal += chunk.normals.size();
+            n_corners += chunk.corners.size(); n_polygons += chunk.polygons.size();
+        }
+
+        positions.resize(total.position); texture_coordinates.resize(total.texture_coordinate); normals.resize(total.normal);
+        corners.resize(n_corners); polygons.resize(n_polygons + 1);
+        polygons[n_polygons] = n_corners;
+
+        std::atomic<bool> failed{false};
+        parallel_for(n_threads, chunks.size(), [&] (u64 k)
+        {
+            Chunk & chunk = chunks[k];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.offsets.position);
+            std::copy(chunk.texture_coordinates.begin(), chunk.texture_coordinates.end(), texture_coordinates.begin() + chunk.offsets.texture_coordinate);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.offsets.normal);
+
+            bool chunk_failed = false;
+            u64 c = 0;
+            for (u64 f = 0; f < chunk.polygons.size(); f++)
+            {
+                polygons[chunk.polygon_offset + f] = chunk.corner_offset + c;
+                Corner const& count = chunk.counts[f];
+                for (u32 i = 0; i < chunk.polygons[f]; i++, c++)
+                {
+                    Corner const& corner = chunk.corners[c];
+                    Corner & resolved = corners[chunk.corner_offset + c];
+                    resolved.position           = _resolve(corner.position, chunk.offsets.position + count.position, positions.size(), chunk_failed);
+                    resolved.texture_coordinate = _resolve(corner.texture_coordinate, chunk.offsets.texture_coordinate + count.texture_coordinate, texture_coordinates.size(), chunk_failed);
+                    resolved.normal             = _resolve(corner.normal, chunk.offsets.normal + count.normal, normals.size(), chunk_failed);
+                }
+            }
+            // every corner has a position
+            for (u64 i = 0; i < chunk.corners.size(); i++) { chunk_failed |= corners[chunk.corner_offset + i].position < 0; }
+            if (chunk_failed) { failed.store(true, std::memory_order_relaxed); }
+            chunk = Chunk{};
+        });
+        return !failed;
+    }
+};
+
+} // namespace nyasRT
@@ -31,18 +31,21 @@ class TraceRecord
 public:
 
     RGB ray_color, reflect_color;
+    f32 bounds_pdf; // the density of BRDF choosing the current ray, 0 if it is not chosen by BRDF sampling
+    fg cone_width, cone_spread; // the ray cone of current ray, its width at ray origin & its spread angle
     fg max_ray_time;
     vec3g hit_point;
     normal3g face_normal, hit_normal;
     vec2g hit_face, hit_texture;
+    fg hit_texture_scale;   // the distance in texture coordinate per unit distance in world space around hit point
     Object3D const* object_p;
 #if defined(NYASRT_SHOW_TRACE_INFO)
     u32 box_count, triangle_count, trace_count;
 #endif
 
     VEC_CONSTEXPR TraceRecord() noexcept
-    : ray_color{consts<RGB>::Black}, reflect_color{consts<RGB>::White}
-    , max_ray_time{consts<fg>::inf} , object_p{nullptr}
+    : ray_color{consts<RGB>::Black}, reflect_color{consts<RGB>::White}, bounds_pdf{0}
+    , cone_width{0}, cone_spread{0}, max_ray_time{consts<fg>::inf}, hit_texture_scale{0}, object_p{nullptr}
 #if defined(NYASRT_SHOW_TRACE_INFO)
     , box_count{0}, triangle_count{0}, trace_count{0}
 #endif
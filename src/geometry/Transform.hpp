@@ -94,6 +94,62 @@ inline Rotation operator^(Rotation const& rot, fg s) noexcept
 }
 
 
+// 3x4 affine matrix, stored as 4 columns where the last one is the translation
+class Affine final
+{
+public:
+
+    vec3g c0, c1, c2, c3;
+
+    VEC_CONSTEXPR Affine() noexcept
+    : c0{consts<vec3g>::X}, c1{consts<vec3g>::Y}, c2{consts<vec3g>::Z}, c3{consts<vec3g>::O} {}
+    VEC_CONSTEXPR Affine(vec3g const& c0_, vec3g const& c1_, vec3g const& c2_, vec3g const& c3_) noexcept
+    : c0{c0_}, c1{c1_}, c2{c2_}, c3{c3_} {}
+
+    VEC_CONSTEXPR fg determinant() const noexcept
+    {
+        return dot(c0, cross(c1, c2));
+    }
+
+    // only valid if the matrix is invertible
+    VEC_CONSTEXPR Affine inverse() const noexcept
+    {
+        // rows of the inversed linear part are the cross products of columns
+        fg const inv_det = 1 / determinant();
+        vec3g const r0 = cross(c1, c2) * inv_det;
+        vec3g const r1 = cross(c2, c0) * inv_det;
+        vec3g const r2 = cross(c0, c1) * inv_det;
+        Affine inv(vec3g(r0.x, r1.x, r2.x), vec3g(r0.y, r1.y, r2.y), vec3g(r0.z, r1.z, r2.z), consts<vec3g>::O);
+        inv.c3 = -inv.apply_vector(c3);
+        return inv;
+    }
+
+    VEC_CONSTEXPR vec3g apply_vector(vec3g const& v) const noexcept
+    {
+        return c0 * v.x + c1 * v.y + c2 * v.z;
+    }
+    VEC_CONSTEXPR vec3g apply_point(vec3g const& p) const noexcept
+    {
+        return apply_vector(p) + c3;
+    }
+    // apply the transposed linear part, normals should be transformed by the transposed inverse matrix
+    VEC_CONSTEXPR vec3g apply_transposed(vec3g const& v) const noexcept
+    {
+        return vec3g(dot(c0, v), dot(c1, v), dot(c2, v));
+    }
+
+    VEC_CONSTEXPR Ray apply(Ray const& ray) const noexcept
+    {
+        return Ray(apply_point(ray.origin), apply_vector(ray.direction));
+    }
+};
+
+VEC_CONSTEXPR inline Affine operator*(Affine const& second, Affine const& first) noexcept
+{
+    return Affine(second.apply_vector(first.c0), second.apply_vector(first.c1), second.apply_vector(first.c2), second.apply_point(first.c3));
+}
+
+
 // transform a `Mesh` from model space to world space
 class Transform final
 {
@@ -102,9 +158,15 @@ public:
     Rotation rotation;
     fg scaler;
     vec3g offset;
+    vec3g stretcher;    // non-uniform scale in model space, applied before any other transform
+
+    // matrices baked in `prepare`, they are used in hot trace paths instead of the quaternion products
+    Affine model_to_world, world_to_model;
+    Affine normal_matrix;   // the transposed inverse of linear part, transform normals from model space to world space
 
     VEC_CONSTEXPR Transform() noexcept
-    : rotation{}, scaler{1}, offset{consts<vec3g>::O} {}
+    : rotation{}, scaler{1}, offset{consts<vec3g>::O}, stretcher{1, 1, 1}
+    , model_to_world{}, world_to_model{}, normal_matrix{} {}
 
     VEC_CONSTEXPR Transform & rotate(normal3g const& axis, fg angle) noexcept
     {
@@ -127,31 +189,60 @@ public:
         offset += offset_;
         return *this;
     }
+    // scale the model along its own axes, no matter when it is called
+    VEC_CONSTEXPR Transform & stretch(vec3g const& stretch_) noexcept
+    {
+        stretcher *= stretch_;
+        return *this;
+    }
+
+    // bake matrices, must be called again after the transform is modified
+    VEC_CONSTEXPR bool prepare() noexcept
+    {
+        model_to_world = matrix();
+        // singular or nearly, relative to the cubed scale of matrix so that uniformly scaled models are fine at any scale
+        fg const det = model_to_world.determinant();
+        fg const scale = std::max({length(model_to_world.c0), length(model_to_world.c1), length(model_to_world.c2)});
+        if (!std::isfinite(det) || !(std::abs(det) > consts<fg>::eps * scale * scale * scale)) { return false; }
+        world_to_model = model_to_world.inverse();
+        Affine const& inv = world_to_model;
+        normal_matrix = Affine(vec3g(inv.c0.x, inv.c1.x, inv.c2.x), vec3g(inv.c0.y, inv.c1.y, inv.c2.y), vec3g(inv.c0.z, inv.c1.z, inv.c2.z), consts<vec3g>::O);
+        return true;
+    }
+
+    // the matrix from model space to world space
+    VEC_CONSTEXPR Affine matrix() const noexcept
+    {
+        return Affine(apply_vector(consts<vec3g>::X), apply_vector(consts<vec3g>::Y), apply_vector(consts<vec3g>::Z), offset);
+    }
 
+    // only exact if `stretcher` is uniform, use `world_to_model` otherwise
     VEC_CONSTEXPR Transform inverse() const noexcept
     {
         Transform inv;
         inv.rotation = rotation.inverse();
         inv.scaler = 1 / scaler;
-        inv.offset = -offset;
+        inv.offset = -rotation.undo(offset) / scaler;
+        inv.stretcher = fg(1) / stretcher;
         return inv;
     }
 
+    // normals are not normalized after transformed
     VEC_CONSTEXPR vec3g apply_normal(vec3g const& n) const noexcept
     {
-        return rotation.apply(n);
+        return rotation.apply(n / stretcher);
     }
     VEC_CONSTEXPR vec3g undo_normal(vec3g const& n) const noexcept
     {
-        return rotation.undo(n);
+        return rotation.undo(n) * stretcher;
     }
     VEC_CONSTEXPR vec3g apply_vector(vec3g const& v) const noexcept
     {
-        return apply_normal(v) / scaler;
+        return rotation.apply(v * stretcher) * scaler;
     }
     VEC_CONSTEXPR vec3g undo_vector(vec3g const& v) const noexcept
     {
-        return undo_normal(v) / scaler;
+        return rotation.undo(v) / (scaler * stretcher);
     }
     VEC_CONSTEXPR vec3g apply_point(vec3g const& p) const noexcept
     {
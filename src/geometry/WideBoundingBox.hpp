@@ -0,0 +1,132 @@
+#pragma once
+
+#include <limits>
+#include <math.h>
+
+#if defined(__AVX__) || defined(__SSE__)
+#   include <immintrin.h>
+#endif
+
+#include "../common.hpp"
+#include "BoundingBox.hpp"
+#include "Ray.hpp"
+
+
+namespace nyasRT
+{
+// `W` bounding boxes stored in SoA form, so that a ray can be traced against all of them at once
+template<u32 W> class WideBoundingBox
+{
+    static_assert((W == 4) || (W == 8), "only 4-wide or 8-wide boxes are supported");
+
+public:
+
+    static constexpr u32 width = W;
+
+    alignas(sizeof(fg) * W) fg min_x[W];
+    alignas(sizeof(fg) * W) fg min_y[W];
+    alignas(sizeof(fg) * W) fg min_z[W];
+    alignas(sizeof(fg) * W) fg max_x[W];
+    alignas(sizeof(fg) * W) fg max_y[W];
+    alignas(sizeof(fg) * W) fg max_z[W];
+
+    // all boxes are empty, their corners are NaN so that every ordered comparison in `trace` fails & they are never hit.
+    // note that `consts<fg>::inf` is finite, a box from `inf` to `-inf` would be hit by every ray
+    constexpr WideBoundingBox() noexcept
+    {
+        for (u32 k = 0; k < W; k++)
+        {
+            min_x[k] = min_y[k] = min_z[k] = std::numeric_limits<fg>::quiet_NaN();
+            max_x[k] = max_y[k] = max_z[k] = std::numeric_limits<fg>::quiet_NaN();
+        }
+    }
+
+    VEC_CONSTEXPR WideBoundingBox & box(u32 index, BoundingBox const& box_) noexcept
+    {
+        min_x[index] = box_.min_corner.x; min_y[index] = box_.min_corner.y; min_z[index] = box_.min_corner.z;
+        max_x[index] = box_.max_corner.x; max_y[index] = box_.max_corner.y; max_z[index] = box_.max_corner.z;
+        return *this;
+    }
+    VEC_CONSTEXPR BoundingBox box(u32 index) const noexcept
+    {
+        BoundingBox box_;
+        box_.min_corner = vec3g(min_x[index], min_y[index], min_z[index]);
+        box_.max_corner = vec3g(max_x[index], max_y[index], max_z[index]);
+        return box_;
+    }
+
+    /// @param inv_d `1 / ray.direction`
+    /// @param time_in output the time of ray entering each box
+    /// @param time_out_scale the time of ray leaving boxes is scaled by it, slightly greater than 1 for conservative tests
+    /// @return bit mask of boxes hit by the ray before `max_ray_time`, same as `BoundingBox::trace`. empty boxes are never in it
+    u32 trace(Ray const& ray, vec3g const& inv_d, fg max_ray_time, fg * time_in, fg time_out_scale = 1) const noexcept
+    {
+#if defined(__AVX__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+        if constexpr (W == 8)
+        {
+            __m256 const o_x = _mm256_set1_ps(ray.origin.x), i_x = _mm256_set1_ps(inv_d.x);
+            __m256 const o_y = _mm256_set1_ps(ray.origin.y), i_y = _mm256_set1_ps(inv_d.y);
+            __m256 const o_z = _mm256_set1_ps(ray.origin.z), i_z = _mm256_set1_ps(inv_d.z);
+
+            __m256 const t0_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(min_x), o_x), i_x);
+            __m256 const t1_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(max_x), o_x), i_x);
+            __m256 const t0_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(min_y), o_y), i_y);
+            __m256 const t1_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(max_y), o_y), i_y);
+            __m256 const t0_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(min_z), o_z), i_z);
+            __m256 const t1_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(max_z), o_z), i_z);
+
+            __m256 const t_in  = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(t0_x, t1_x), _mm256_min_ps(t0_y, t1_y)), _mm256_min_ps(t0_z, t1_z));
+            __m256 const t_out = _mm256_mul_ps(_mm256_min_ps(_mm256_min_ps(_mm256_max_ps(t0_x, t1_x), _mm256_max_ps(t0_y, t1_y)), _mm256_max_ps(t0_z, t1_z)), _mm256_set1_ps(time_out_scale));
+
+            __m256 hit = _mm256_cmp_ps(t_out, _mm256_set1_ps(consts<fg>::eps), _CMP_GE_OQ);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_in, _mm256_set1_ps(max_ray_time), _CMP_LT_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t_in, t_out, _CMP_LT_OQ));
+
+            _mm256_store_ps(time_in, t_in);
+            return static_cast<u32>(_mm256_movemask_ps(hit));
+        }
+#endif
+#if defined(__SSE__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+        if constexpr (W == 4)
+        {
+            __m128 const o_x = _mm_set1_ps(ray.origin.x), i_x = _mm_set1_ps(inv_d.x);
+            __m128 const o_y = _mm_set1_ps(ray.origin.y), i_y = _mm_set1_ps(inv_d.y);
+            __m128 const o_z = _mm_set1_ps(ray.origin.z), i_z = _mm_set1_ps(inv_d.z);
+
+            __m128 const t0_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(min_x), o_x), i_x);
+            __m128 const t1_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(max_x), o_x), i_x);
+            __m128 const t0_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(min_y), o_y), i_y);
+            __m128 const t1_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(max_y), o_y), i_y);
+            __m128 const t0_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(min_z), o_z), i_z);
+            __m128 const t1_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(max_z), o_z), i_z);
+
+            __m128 const t_in  = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0_x, t1_x), _mm_min_ps(t0_y, t1_y)), _mm_min_ps(t0_z, t1_z));
+            __m128 const t_out = _mm_mul_ps(_mm_min_ps(_mm_min_ps(_mm_max_ps(t0_x, t1_x), _mm_max_ps(t0_y, t1_y)), _mm_max_ps(t0_z, t1_z)), _mm_set1_ps(time_out_scale));
+
+            __m128 hit = _mm_cmpge_ps(t_out, _mm_set1_ps(consts<fg>::eps));
+            hit = _mm_and_ps(hit, _mm_cmplt_ps(t_in, _mm_set1_ps(max_ray_time)));
+            hit = _mm_and_ps(hit, _mm_cmplt_ps(t_in, t_out));
+
+            _mm_store_ps(time_in, t_in);
+            return static_cast<u32>(_mm_movemask_ps(hit));
+        }
+#endif
+        // fallback, hopefully vectorized by compiler
+        u32 mask = 0;
+        for (u32 k = 0; k < W; k++)
+        {
+            fg const t0_x = (min_x[k] - ray.origin.x) * inv_d.x, t1_x = (max_x[k] - ray.origin.x) * inv_d.x;
+            fg const t0_y = (min_y[k] - ray.origin.y) * inv_d.y, t1_y = (max_y[k] - ray.origin.y) * inv_d.y;
+            fg const t0_z = (min_z[k] - ray.origin.z) * inv_d.z, t1_z = (max_z[k] - ray.origin.z) * inv_d.z;
+
+            fg const t_in  = std::max(std::max(std::min(t0_x, t1_x), std::min(t0_y, t1_y)), std::min(t0_z, t1_z));
+            fg const t_out = std::min(std::min(std::max(t0_x, t1_x), std::max(t0_y, t1_y)), std::max(t0_z, t1_z)) * time_out_scale;
+
+            time_in[k] = t_in;
+            mask |= static_cast<u32>(BoundingBox::intersect(t_in, t_out, max_ray_time)) << k;
+        }
+        return mask;
+    }
+};
+
+} // namespace nyasRT
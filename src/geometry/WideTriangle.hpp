@@ -0,0 +1,390 @@
+#pragma once
+
+#include <math.h>
+#include <utility>
+
+#if defined(__AVX__) || defined(__SSE__)
+#   include <immintrin.h>
+#endif
+
+#include "../common.hpp"
+#include "Ray.hpp"
+
+
+namespace nyasRT
+{
+// the ray-triangle intersection test used by meshes, all of them cull the back faces
+enum class TriangleTest : u8
+{
+    Projection,         // project the hit point on the face & solve coordinates with the face constants, edges are excluded
+    MollerTrumbore,     // Möller & Trumbore, solve hit time & coordinates at once by Cramer's rule, edges are included but the
+                        // rounding errors differ between the faces sharing an edge, so rays may still slip through
+    Watertight,         // Woop, Benthin & Wald, shear the triangle into ray space so that no ray can slip through shared edges
+};
+
+
+// the ray transformed for `TriangleTest::Watertight`, where the ray goes along the `kz` axis from the origin
+class WatertightRay
+{
+public:
+
+    vec3g origin;
+    u32 kx, ky, kz;
+    fg shear_x, shear_y, shear_z;
+
+    VEC_CONSTEXPR WatertightRay(Ray const& ray) noexcept
+    : origin{ray.origin}
+    {
+        vec3g const d = abs(ray.direction);
+        kz = (d.x > d.y) ? ((d.x > d.z) ? 0 : 2) : ((d.y > d.z) ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // keep the winding of faces
+        if (ray.direction[kz] < 0) { std::swap(kx, ky); }
+
+        shear_x = ray.direction[kx] / ray.direction[kz];
+        shear_y = ray.direction[ky] / ray.direction[kz];
+        shear_z = 1 / ray.direction[kz];
+    }
+};
+
+
+namespace lanes
+{
+// thin wrappers of SIMD instructions, so that the kernels of `WideTriangle` are written once for any width
+class Scalar
+{
+public:
+
+    static constexpr u32 width = 1;
+    using V = fg;
+    using M = bool;
+
+    static inline V set1(fg x) noexcept { return x; }
+    static inline V load(fg const* p) noexcept { return *p; }
+    static inline void store(fg * p, V x) noexcept { *p = x; }
+    static inline V add(V a, V b) noexcept { return a + b; }
+    static inline V sub(V a, V b) noexcept { return a - b; }
+    static inline V mul(V a, V b) noexcept { return a * b; }
+    static inline V div(V a, V b) noexcept { return a / b; }
+    static inline M lt(V a, V b) noexcept { return a < b; }
+    static inline M ge(V a, V b) noexcept { return a >= b; }
+    static inline M gt(V a, V b) noexcept { return a > b; }
+    static inline M land(M a, M b) noexcept { return a && b; }
+    static inline M lor(M a, M b) noexcept { return a || b; }
+    static inline u32 mask(M m) noexcept { return m ? 1 : 0; }
+
+    // `ax * by - ay * bx` in double precision, where products of floats are exact, so that the sign is exact
+    // & the result is the same whether the compiler contracts it into FMA or not
+    static inline V cross(V ax, V ay, V bx, V by) noexcept
+    {
+        return static_cast<fg>(f64(ax) * f64(by) - f64(ay) * f64(bx));
+    }
+    // `ax * bx + ay * by + az * bz` in double precision, for the same reason as `cross`
+    static inline V dot(V ax, V ay, V az, V bx, V by, V bz) noexcept
+    {
+        return static_cast<fg>(f64(ax) * f64(bx) + f64(ay) * f64(by) + f64(az) * f64(bz));
+    }
+
+    // the same for vectors, so that the scalar tests of `Mesh` get the same results as the wide ones
+    static inline vec3g cross(vec3g const& a, vec3g const& b) noexcept
+    {
+        return vec3g(cross(a.y, a.z, b.y, b.z), cross(a.z, a.x, b.z, b.x), cross(a.x, a.y, b.x, b.y));
+    }
+    static inline fg dot(vec3g const& a, vec3g const& b) noexcept
+    {
+        return dot(a.x, a.y, a.z, b.x, b.y, b.z);
+    }
+};
+
+#if defined(__SSE2__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+class SSE
+{
+public:
+
+    static constexpr u32 width = 4;
+    using V = __m128;
+    using M = __m128;
+
+    static inline V set1(fg x) noexcept { return _mm_set1_ps(x); }
+    static inline V load(fg const* p) noexcept { return _mm_load_ps(p); }
+    static inline void store(fg * p, V x) noexcept { _mm_store_ps(p, x); }
+    static inline V add(V a, V b) noexcept { return _mm_add_ps(a, b); }
+    static inline V sub(V a, V b) noexcept { return _mm_sub_ps(a, b); }
+    static inline V mul(V a, V b) noexcept { return _mm_mul_ps(a, b); }
+    static inline V div(V a, V b) noexcept { return _mm_div_ps(a, b); }
+    static inline M lt(V a, V b) noexcept { return _mm_cmplt_ps(a, b); }
+    static inline M ge(V a, V b) noexcept { return _mm_cmpge_ps(a, b); }
+    static inline M gt(V a, V b) noexcept { return _mm_cmpgt_ps(a, b); }
+    static inline M land(M a, M b) noexcept { return _mm_and_ps(a, b); }
+    static inline M lor(M a, M b) noexcept { return _mm_or_ps(a, b); }
+    static inline u32 mask(M m) noexcept { return static_cast<u32>(_mm_movemask_ps(m)); }
+
+    static inline V cross(V ax, V ay, V bx, V by) noexcept
+    {
+        auto half = [] (__m128 ax, __m128 ay, __m128 bx, __m128 by) noexcept -> __m128
+        {
+            return _mm_cvtpd_ps(_mm_sub_pd(_mm_mul_pd(_mm_cvtps_pd(ax), _mm_cvtps_pd(by)), _mm_mul_pd(_mm_cvtps_pd(ay), _mm_cvtps_pd(bx))));
+        };
+        return _mm_movelh_ps(half(ax, ay, bx, by), half(_mm_movehl_ps(ax, ax), _mm_movehl_ps(ay, ay), _mm_movehl_ps(bx, bx), _mm_movehl_ps(by, by)));
+    }
+    static inline V dot(V ax, V ay, V az, V bx, V by, V bz) noexcept
+    {
+        auto half = [] (__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) noexcept -> __m128
+        {
+            __m128d const xx = _mm_mul_pd(_mm_cvtps_pd(ax), _mm_cvtps_pd(bx));
+            __m128d const yy = _mm_mul_pd(_mm_cvtps_pd(ay), _mm_cvtps_pd(by));
+            __m128d const zz = _mm_mul_pd(_mm_cvtps_pd(az), _mm_cvtps_pd(bz));
+            return _mm_cvtpd_ps(_mm_add_pd(_mm_add_pd(xx, yy), zz));
+        };
+        auto high = [] (__m128 x) noexcept { return _mm_movehl_ps(x, x); };
+        return _mm_movelh_ps(half(ax, ay, az, bx, by, bz), half(high(ax), high(ay), high(az), high(bx), high(by), high(bz)));
+    }
+};
+#endif
+
+#if defined(__AVX__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+class AVX
+{
+public:
+
+    static constexpr u32 width = 8;
+    using V = __m256;
+    using M = __m256;
+
+    static inline V set1(fg x) noexcept { return _mm256_set1_ps(x); }
+    static inline V load(fg const* p) noexcept { return _mm256_load_ps(p); }
+    static inline void store(fg * p, V x) noexcept { _mm256_store_ps(p, x); }
+    static inline V add(V a, V b) noexcept { return _mm256_add_ps(a, b); }
+    static inline V sub(V a, V b) noexcept { return _mm256_sub_ps(a, b); }
+    static inline V mul(V a, V b) noexcept { return _mm256_mul_ps(a, b); }
+    static inline V div(V a, V b) noexcept { return _mm256_div_ps(a, b); }
+    static inline M lt(V a, V b) noexcept { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static inline M ge(V a, V b) noexcept { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static inline M gt(V a, V b) noexcept { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+    static inline M land(M a, M b) noexcept { return _mm256_and_ps(a, b); }
+    static inline M lor(M a, M b) noexcept { return _mm256_or_ps(a, b); }
+    static inline u32 mask(M m) noexcept { return static_cast<u32>(_mm256_movemask_ps(m)); }
+
+    static inline V cross(V ax, V ay, V bx, V by) noexcept
+    {
+        auto half = [] (__m128 ax, __m128 ay, __m128 bx, __m128 by) noexcept -> __m128
+        {
+            return _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_mul_pd(_mm256_cvtps_pd(ax), _mm256_cvtps_pd(by)), _mm256_mul_pd(_mm256_cvtps_pd(ay), _mm256_cvtps_pd(bx))));
+        };
+        __m128 const low = half(_mm256_castps256_ps128(ax), _mm256_castps256_ps128(ay), _mm256_castps256_ps128(bx), _mm256_castps256_ps128(by));
+        __m128 const high = half(_mm256_extractf128_ps(ax, 1), _mm256_extractf128_ps(ay, 1), _mm256_extractf128_ps(bx, 1), _mm256_extractf128_ps(by, 1));
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+    }
+    static inline V dot(V ax, V ay, V az, V bx, V by, V bz) noexcept
+    {
+        auto half = [] (__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) noexcept -> __m128
+        {
+            __m256d const xx = _mm256_mul_pd(_mm256_cvtps_pd(ax), _mm256_cvtps_pd(bx));
+            __m256d const yy = _mm256_mul_pd(_mm256_cvtps_pd(ay), _mm256_cvtps_pd(by));
+            __m256d const zz = _mm256_mul_pd(_mm256_cvtps_pd(az), _mm256_cvtps_pd(bz));
+            return _mm256_cvtpd_ps(_mm256_add_pd(_mm256_add_pd(xx, yy), zz));
+        };
+        auto low = [] (__m256 x) noexcept { return _mm256_castps256_ps128(x); };
+        auto high = [] (__m256 x) noexcept { return _mm256_extractf128_ps(x, 1); };
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(half(low(ax), low(ay), low(az), low(bx), low(by), low(bz))),
+            half(high(ax), high(ay), high(az), high(bx), high(by), high(bz)), 1);
+    }
+};
+#endif
+
+// the widest lanes not wider than `W`
+template<u32 W> auto widest() noexcept
+{
+#if defined(__AVX__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+    if constexpr (W >= 8) { return AVX{}; } else
+#endif
+#if defined(__SSE2__) && !defined(NYASRT_USE_DOUBLE_PRECISION_GEOMETRY)
+    if constexpr (W >= 4) { return SSE{}; } else
+#endif
+    { return Scalar{}; }
+}
+
+} // namespace lanes
+
+
+// `W` triangles stored in SoA form with the edges & constants precomputed, so that a ray can be tested against all of them at once.
+// the tests are the same as the ones of `Mesh`
+template<u32 W> class WideTriangle
+{
+    static_assert((W == 4) || (W == 8), "only 4-wide or 8-wide triangles are supported");
+
+    template<class L> using Vec = typename L::V;
+
+    // the kernels test lanes `[k, k + L::width)`
+    template<class L> u32 _trace_projection(u32 k, Ray const& ray, fg max_ray_time, fg * times, fg * us, fg * vs) const noexcept
+    {
+        Vec<L> const o_x = L::set1(ray.origin.x), d_x = L::set1(ray.direction.x);
+        Vec<L> const o_y = L::set1(ray.origin.y), d_y = L::set1(ray.direction.y);
+        Vec<L> const o_z = L::set1(ray.origin.z), d_z = L::set1(ray.direction.z);
+        Vec<L> const nx = L::load(n_x + k), ny = L::load(n_y + k), nz = L::load(n_z + k);
+        Vec<L> const ax = L::load(a_x + k), ay = L::load(a_y + k), az = L::load(a_z + k);
+
+        Vec<L> const d_dot_n = L::add(L::add(L::mul(d_x, nx), L::mul(d_y, ny)), L::mul(d_z, nz));
+        Vec<L> const ao_dot_n = L::add(L::add(L::mul(L::sub(ax, o_x), nx), L::mul(L::sub(ay, o_y), ny)), L::mul(L::sub(az, o_z), nz));
+        Vec<L> const t = L::div(ao_dot_n, d_dot_n);
+
+        Vec<L> const p_x = L::sub(L::add(o_x, L::mul(t, d_x)), ax);
+        Vec<L> const p_y = L::sub(L::add(o_y, L::mul(t, d_y)), ay);
+        Vec<L> const p_z = L::sub(L::add(o_z, L::mul(t, d_z)), az);
+        Vec<L> const co_u = L::add(L::add(L::mul(p_x, L::load(b_x + k)), L::mul(p_y, L::load(b_y + k))), L::mul(p_z, L::load(b_z + k)));
+        Vec<L> const co_v = L::add(L::add(L::mul(p_x, L::load(c_x + k)), L::mul(p_y, L::load(c_y + k))), L::mul(p_z, L::load(c_z + k)));
+
+        Vec<L> const kx = L::load(k_x + k), ky = L::load(k_y + k), kz = L::load(k_z + k);
+        Vec<L> const u = L::sub(L::mul(co_u, kz), L::mul(co_v, ky));
+        Vec<L> const v = L::sub(L::mul(co_v, kx), L::mul(co_u, ky));
+        Vec<L> const w = L::sub(L::sub(L::set1(1), u), v);
+
+        Vec<L> const zero = L::set1(0);
+        auto hit = L::lt(d_dot_n, zero);
+        hit = L::land(hit, L::ge(t, L::set1(consts<fg>::eps)));
+        hit = L::land(hit, L::lt(t, L::set1(max_ray_time)));
+        hit = L::land(hit, L::land(L::gt(u, zero), L::land(L::gt(v, zero), L::gt(w, zero))));
+
+        L::store(times + k, t); L::store(us + k, u); L::store(vs + k, v);
+        return L::mask(hit);
+    }
+
+    template<class L> u32 _trace_moller_trumbore(u32 k, Ray const& ray, fg max_ray_time, fg * times, fg * us, fg * vs) const noexcept
+    {
+        Vec<L> const d_x = L::set1(ray.direction.x), d_y = L::set1(ray.direction.y), d_z = L::set1(ray.direction.z);
+        Vec<L> const e1_x = L::load(b_x + k), e1_y = L::load(b_y + k), e1_z = L::load(b_z + k);
+        Vec<L> const e2_x = L::load(c_x + k), e2_y = L::load(c_y + k), e2_z = L::load(c_z + k);
+
+        // p = d x e2, det = e1 . p, by the exact products of `L::cross` & `L::dot` so that `Mesh` gets the same results
+        Vec<L> const p_x = L::cross(d_y, d_z, e2_y, e2_z);
+        Vec<L> const p_y = L::cross(d_z, d_x, e2_z, e2_x);
+        Vec<L> const p_z = L::cross(d_x, d_y, e2_x, e2_y);
+        Vec<L> const det = L::dot(e1_x, e1_y, e1_z, p_x, p_y, p_z);
+
+        // s = o - a, u = s . p, q = s x e1, v = d . q, t = e2 . q
+        Vec<L> const s_x = L::sub(L::set1(ray.origin.x), L::load(a_x + k));
+        Vec<L> const s_y = L::sub(L::set1(ray.origin.y), L::load(a_y + k));
+        Vec<L> const s_z = L::sub(L::set1(ray.origin.z), L::load(a_z + k));
+        Vec<L> const u = L::dot(s_x, s_y, s_z, p_x, p_y, p_z);
+        Vec<L> const q_x = L::cross(s_y, s_z, e1_y, e1_z);
+        Vec<L> const q_y = L::cross(s_z, s_x, e1_z, e1_x);
+        Vec<L> const q_z = L::cross(s_x, s_y, e1_x, e1_y);
+        Vec<L> const v = L::dot(d_x, d_y, d_z, q_x, q_y, q_z);
+        Vec<L> const t = L::dot(e2_x, e2_y, e2_z, q_x, q_y, q_z);
+
+        Vec<L> const zero = L::set1(0);
+        Vec<L> const inv_det = L::div(L::set1(1), det);
+        Vec<L> const time = L::mul(t, inv_det);
+        auto hit = L::gt(det, zero);
+        hit = L::land(hit, L::land(L::ge(u, zero), L::ge(v, zero)));
+        hit = L::land(hit, L::ge(det, L::add(u, v)));
+        hit = L::land(hit, L::ge(time, L::set1(consts<fg>::eps)));
+        hit = L::land(hit, L::lt(time, L::set1(max_ray_time)));
+
+        L::store(times + k, time); L::store(us + k, L::mul(u, inv_det)); L::store(vs + k, L::mul(v, inv_det));
+        return L::mask(hit);
+    }
+
+    template<class L> u32 _trace_watertight(u32 k, WatertightRay const& ray, fg max_ray_time, fg * times, fg * us, fg * vs) const noexcept
+    {
+        fg const* a[3] = {a_x + k, a_y + k, a_z + k};
+        fg const* b[3] = {b_x + k, b_y + k, b_z + k};
+        fg const* c[3] = {c_x + k, c_y + k, c_z + k};
+
+        // vertices relative to ray origin
+        Vec<L> const o_x = L::set1(ray.origin[ray.kx]), o_y = L::set1(ray.origin[ray.ky]), o_z = L::set1(ray.origin[ray.kz]);
+        Vec<L> const az = L::sub(L::load(a[ray.kz]), o_z), bz = L::sub(L::load(b[ray.kz]), o_z), cz = L::sub(L::load(c[ray.kz]), o_z);
+        // shear & scale them, so that the ray goes along z axis
+        Vec<L> const s_x = L::set1(ray.shear_x), s_y = L::set1(ray.shear_y);
+        Vec<L> const ax = L::sub(L::sub(L::load(a[ray.kx]), o_x), L::mul(s_x, az)), ay = L::sub(L::sub(L::load(a[ray.ky]), o_y), L::mul(s_y, az));
+        Vec<L> const bx = L::sub(L::sub(L::load(b[ray.kx]), o_x), L::mul(s_x, bz)), by = L::sub(L::sub(L::load(b[ray.ky]), o_y), L::mul(s_y, bz));
+        Vec<L> const cx = L::sub(L::sub(L::load(c[ray.kx]), o_x), L::mul(s_x, cz)), cy = L::sub(L::sub(L::load(c[ray.ky]), o_y), L::mul(s_y, cz));
+
+        // the edge functions, i.e. scaled barycentric coordinates of A, B & C. the shared edges of faces get exactly opposite values
+        Vec<L> const e_bc = L::cross(cx, cy, bx, by);
+        Vec<L> const e_ca = L::cross(ax, ay, cx, cy);
+        Vec<L> const e_ab = L::cross(bx, by, ax, ay);
+
+        Vec<L> const zero = L::set1(0);
+        Vec<L> const s_z = L::set1(ray.shear_z);
+        Vec<L> const det = L::add(L::add(e_bc, e_ca), e_ab);
+        Vec<L> const T = L::add(L::add(L::mul(e_bc, L::mul(s_z, az)), L::mul(e_ca, L::mul(s_z, bz))), L::mul(e_ab, L::mul(s_z, cz)));
+        Vec<L> const inv_det = L::div(L::set1(1), det);
+        Vec<L> const time = L::mul(T, inv_det);
+
+        auto hit = L::land(L::ge(e_bc, zero), L::land(L::ge(e_ca, zero), L::ge(e_ab, zero)));
+        hit = L::land(hit, L::gt(det, zero));
+        hit = L::land(hit, L::ge(time, L::set1(consts<fg>::eps)));
+        hit = L::land(hit, L::lt(time, L::set1(max_ray_time)));
+
+        L::store(times + k, time); L::store(us + k, L::mul(e_ca, inv_det)); L::store(vs + k, L::mul(e_ab, inv_det));
+        return L::mask(hit);
+    }
+
+public:
+
+    static constexpr u32 width = W;
+
+    alignas(sizeof(fg) * W) fg a_x[W], a_y[W], a_z[W];     // vertex A
+    alignas(sizeof(fg) * W) fg b_x[W], b_y[W], b_z[W];     // edge B - A, or vertex B for watertight test so that shared vertices are exact
+    alignas(sizeof(fg) * W) fg c_x[W], c_y[W], c_z[W];     // edge C - A, or vertex C for watertight test
+    alignas(sizeof(fg) * W) fg n_x[W], n_y[W], n_z[W];     // face normal
+    alignas(sizeof(fg) * W) fg k_x[W], k_y[W], k_z[W];     // face constants
+    u32 face[W];    // the index of face in mesh
+
+    // all lanes are empty, the degenerate triangles cannot be hit
+    constexpr WideTriangle() noexcept
+    {
+        for (u32 k = 0; k < W; k++)
+        {
+            a_x[k] = a_y[k] = a_z[k] = b_x[k] = b_y[k] = b_z[k] = c_x[k] = c_y[k] = c_z[k] = 0;
+            n_x[k] = n_y[k] = n_z[k] = k_x[k] = k_y[k] = k_z[k] = 0;
+            face[k] = 0;
+        }
+    }
+
+    VEC_CONSTEXPR WideTriangle & triangle(u32 index, vec3g const& A, vec3g const& B, vec3g const& C, normal3g const& normal, vec3g const& constants,
+        u32 face_index, TriangleTest test = TriangleTest::Projection) noexcept
+    {
+        vec3g const AB = (test == TriangleTest::Watertight) ? B : B - A;
+        vec3g const AC = (test == TriangleTest::Watertight) ? C : C - A;
+        a_x[index] = A.x; a_y[index] = A.y; a_z[index] = A.z;
+        b_x[index] = AB.x; b_y[index] = AB.y; b_z[index] = AB.z;
+        c_x[index] = AC.x; c_y[index] = AC.y; c_z[index] = AC.z;
+        n_x[index] = normal.x; n_y[index] = normal.y; n_z[index] = normal.z;
+        k_x[index] = constants.x; k_y[index] = constants.y; k_z[index] = constants.z;
+        face[index] = face_index;
+        return *this;
+    }
+
+    /// @param test should be the same as the one the triangles are set with
+    /// @param sheared the same ray transformed, only used by `TriangleTest::Watertight` & made once for all packs on the way of ray
+    /// @param times, us, vs output the hit time & the coordinates of B & C on each triangle
+    /// @return bit mask of triangles hit by the ray before `max_ray_time`
+    u32 trace(TriangleTest test, Ray const& ray, WatertightRay const& sheared, fg max_ray_time, fg * times, fg * us, fg * vs) const noexcept
+    {
+        using L = decltype(lanes::widest<W>());
+        u32 mask = 0;
+        switch (test)
+        {
+        case TriangleTest::MollerTrumbore:
+            for (u32 k = 0; k < W; k += L::width) { mask |= _trace_moller_trumbore<L>(k, ray, max_ray_time, times, us, vs) << k; }
+            break;
+        case TriangleTest::Watertight:
+            for (u32 k = 0; k < W; k += L::width) { mask |= _trace_watertight<L>(k, sheared, max_ray_time, times, us, vs) << k; }
+            break;
+        default:
+            for (u32 k = 0; k < W; k += L::width) { mask |= _trace_projection<L>(k, ray, max_ray_time, times, us, vs) << k; }
+            break;
+        }
+        return mask;
+    }
+
+    u32 trace(TriangleTest test, Ray const& ray, fg max_ray_time, fg * times, fg * us, fg * vs) const noexcept
+    {
+        return trace(test, ray, WatertightRay(ray), max_ray_time, times, us, vs);
+    }
+};
+
+} // namespace nyasRT
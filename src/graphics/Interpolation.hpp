@@ -19,28 +19,29 @@ public:
         Bicubic
     };
 
+    /// @param fetch returns the texel at `index2_t`, so that the image is not necessary to be continuous
     /// @param pos in [0,1)^2
-    static VEC_CONSTEXPR inline RGB nearest(RGB const* data, size2_t size, vec2g pos) noexcept
+    template<class Fetch> static VEC_CONSTEXPR inline RGB nearest(Fetch const& fetch, size2_t size, vec2g pos) noexcept
     {
         pos.x = std::fmod(pos.x * size.x, size.x); pos.y = std::fmod(pos.y * size.y, size.y);
         index2_t const index(std::floor(pos.x), std::floor(pos.y));
 
-        return data[index.x + index.y * size.x];
+        return fetch(index);
     }
     /// @param pos in [0,1)^2
-    static VEC_CONSTEXPR inline RGB bilinear(RGB const* data, size2_t size, vec2g pos) noexcept
+    template<class Fetch> static VEC_CONSTEXPR inline RGB bilinear(Fetch const& fetch, size2_t size, vec2g pos) noexcept
     {
         pos.x = std::fmod(pos.x * size.x, size.x); pos.y = std::fmod(pos.y * size.y, size.y);
         index2_t const index0(std::floor(pos.x), std::floor(pos.y));
         pos -= index0;
         index2_t const index1 = (index0 + 1) % index2_t(size);
 
-        RGB tmp0 = lerp(data[index0.x + index0.y * size.x], data[index1.x + index0.y * size.x], f32(pos.x));
-        RGB tmp1 = lerp(data[index0.x + index1.y * size.x], data[index1.x + index1.y * size.x], f32(pos.x));
+        RGB tmp0 = lerp(fetch(index2_t(index0.x, index0.y)), fetch(index2_t(index1.x, index0.y)), f32(pos.x));
+        RGB tmp1 = lerp(fetch(index2_t(index0.x, index1.y)), fetch(index2_t(index1.x, index1.y)), f32(pos.x));
         return lerp(tmp0, tmp1, f32(pos.y));
     }
     /// @param pos in [0,1)^2
-    static VEC_CONSTEXPR inline RGB bicubic(RGB const* data, size2_t size, vec2g pos) noexcept
+    template<class Fetch> static VEC_CONSTEXPR inline RGB bicubic(Fetch const& fetch, size2_t size, vec2g pos) noexcept
     {
         index2_t const isize = size;
         pos.x = std::fmod(pos.x * size.x, size.x); pos.y = std::fmod(pos.y * size.y, size.y);
@@ -50,11 +51,27 @@ public:
         index2_t const index_1 = (index0 + (isize - 1)) % isize;
         index2_t const index2 = (index0 + 2) % isize;
 
-        RGB tmp_1 = cerp(data[index_1.x + index_1.y * size.x], data[index0.x + index_1.y * size.x], data[index1.x + index_1.y * size.x], data[index2.x + index_1.y * size.x], f32(pos.x));
-        RGB tmp0  = cerp(data[index_1.x + index0.y  * size.x], data[index0.x + index0.y  * size.x], data[index1.x + index0.y  * size.x], data[index2.x + index0.y  * size.x], f32(pos.x));
-        RGB tmp1  = cerp(data[index_1.x + index1.y  * size.x], data[index0.x + index1.y  * size.x], data[index1.x + index1.y  * size.x], data[index2.x + index1.y  * size.x], f32(pos.x));
-        RGB tmp2  = cerp(data[index_1.x + index2.y  * size.x], data[index0.x + index2.y  * size.x], data[index1.x + index2.y  * size.x], data[index2.x + index2.y  * size.x], f32(pos.x));
-        return cerp(tmp_1, tmp0, tmp1, tmp2, f32(pos.y));
+        auto row = [&] (i32 y) -> RGB
+        {
+            return cerp(fetch(index2_t(index_1.x, y)), fetch(index2_t(index0.x, y)), fetch(index2_t(index1.x, y)), fetch(index2_t(index2.x, y)), f32(pos.x));
+        };
+        return cerp(row(index_1.y), row(index0.y), row(index1.y), row(index2.y), f32(pos.y));
+    }
+
+    /// @param pos in [0,1)^2
+    static VEC_CONSTEXPR inline RGB nearest(RGB const* data, size2_t size, vec2g pos) noexcept
+    {
+        return nearest([data, size] (index2_t index) { return data[index.x + index.y * size.x]; }, size, pos);
+    }
+    /// @param pos in [0,1)^2
+    static VEC_CONSTEXPR inline RGB bilinear(RGB const* data, size2_t size, vec2g pos) noexcept
+    {
+        return bilinear([data, size] (index2_t index) { return data[index.x + index.y * size.x]; }, size, pos);
+    }
+    /// @param pos in [0,1)^2
+    static VEC_CONSTEXPR inline RGB bicubic(RGB const* data, size2_t size, vec2g pos) noexcept
+    {
+        return bicubic([data, size] (index2_t index) { return data[index.x + index.y * size.x]; }, size, pos);
     }
 
 private:
@@ -90,6 +107,20 @@ public:
             return nearest(data, size, pos);
         };
     }
+    /// @param fetch returns the texel at `index2_t`
+    /// @param pos in [0,1)^2
+    template<class Fetch> VEC_CONSTEXPR RGB operator()(Fetch const& fetch, size2_t size, vec2g pos) const noexcept
+    {
+        switch (_method)
+        {
+        case Bilinear:
+            return bilinear(fetch, size, pos);
+        case Bicubic:
+            return bicubic(fetch, size, pos);
+        default:
+            return nearest(fetch, size, pos);
+        };
+    }
 };
 
 } // namespace nyasRT
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../common.hpp"
+#include "GraphicsBuffer.hpp"
+#include "image_formats/QOI.hpp"
+
+
+namespace nyasRT
+{
+// a fixed budget of decoded tiles shared by tiled images, a texel is packed in 4 bytes.
+// each slot is guarded by a sequence number like a seqlock, so hits only load atomics & never lock.
+// misses are decoded outside the lock by the caller, the slot to evict is chosen by CLOCK,
+// the approximation of LRU which only needs a referenced bit on hit
+class TileCache final
+{
+public:
+
+    static constexpr u32 tile_size = 64;
+    static constexpr u32 tile_texels = tile_size * tile_size;
+    static constexpr u64 tile_bytes = tile_texels * sizeof(u32);
+
+    // the slot of a tile, `0` if not resident, otherwise the index of slot + 1
+    using Entry = std::atomic<u32>;
+
+private:
+
+    class Slot
+    {
+    public:
+
+        std::atomic<u32> sequence{0};       // odd while being written
+        std::atomic<Entry *> owner{nullptr};
+        mutable std::atomic<u8> referenced{0};
+        std::unique_ptr<std::atomic<u32>[]> texels{new std::atomic<u32>[tile_texels]};
+    };
+
+    u32 _n_slots;
+    std::unique_ptr<Slot[]> _slots;
+    u32 _hand;
+    std::mutex _mutex;
+
+public:
+
+    explicit TileCache(u64 budget_bytes)
+    : _n_slots{static_cast<u32>(std::max<u64>(budget_bytes / tile_bytes, 1))}, _slots{new Slot[_n_slots]}, _hand{0} {}
+    TileCache(TileCache const&) = delete;
+    TileCache & operator = (TileCache const&) = delete;
+
+    // the cache used by tiled textures by default, 256 MiB
+    static std::shared_ptr<TileCache> shared()
+    {
+        static std::shared_ptr<TileCache> cache_p = std::make_shared<TileCache>(u64(256) << 20);
+        return cache_p;
+    }
+
+    u64 budget() const noexcept
+    {
+        return _n_slots * tile_bytes;
+    }
+
+    // load the texel of the tile of `entry`, false if the tile is not resident
+    bool fetch(Entry const& entry, u32 texel_index, u32 & texel) const noexcept
+    {
+        u32 const s = entry.load(std::memory_order_acquire);
+        if (s == 0) { return false; }
+        Slot const& slot = _slots[s - 1];
+
+        u32 const sequence = slot.sequence.load(std::memory_order_acquire);
+        if ((sequence & 1) || (slot.owner.load(std::memory_order_relaxed) != &entry)) { return false; }
+        texel = slot.texels[texel_index].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) { return false; }
+
+        // avoid writing the shared cache line if already set
+        if (slot.referenced.load(std::memory_order_relaxed) == 0) { slot.referenced.store(1, std::memory_order_relaxed); }
+        return true;
+    }
+
+    // put the decoded tile of `entry`, unless another thread has done it
+    void insert(Entry & entry, u32 const* texels) noexcept
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (entry.load(std::memory_order_relaxed) != 0) { return; }
+
+        // give the referenced slots a second chance, found within 2 rounds
+        while (_slots[_hand].referenced.exchange(0, std::memory_order_relaxed) != 0) { _hand = (_hand + 1) % _n_slots; }
+        u32 const index = _hand;
+        _hand = (_hand + 1) % _n_slots;
+
+        Slot & slot = _slots[index];
+        u32 const sequence = slot.sequence.load(std::memory_order_relaxed);
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (Entry * old = slot.owner.load(std::memory_order_relaxed)) { old->store(0, std::memory_order_relaxed); }
+        for (u32 k = 0; k < tile_texels; k++) { slot.texels[k].store(texels[k], std::memory_order_relaxed); }
+        slot.owner.store(&entry, std::memory_order_relaxed);
+        slot.referenced.store(1, std::memory_order_relaxed);
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        entry.store(index + 1, std::memory_order_release);
+    }
+
+    // drop the tiles of entries in [begin, end), before the entries are destroyed
+    void release(Entry * begin, Entry * end) noexcept
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (Entry * entry = begin; entry < end; entry++)
+        {
+            u32 const s = entry->load(std::memory_order_relaxed);
+            if (s == 0) { continue; }
+
+            Slot & slot = _slots[s - 1];
+            u32 const sequence = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.owner.store(nullptr, std::memory_order_relaxed);
+            slot.referenced.store(0, std::memory_order_relaxed);
+            slot.sequence.store(sequence + 2, std::memory_order_release);
+            entry->store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+
+// an image with its mip pyramid kept out of core, as tiles encoded by QOI in a file,
+// tiles are decoded on demand into a `TileCache`. only 8 bits per channel is kept,
+// which is what the image files have
+class TiledImage final
+{
+public:
+
+    using CachePtr = std::shared_ptr<TileCache>;
+    static constexpr u32 tile_size = TileCache::tile_size;
+
+private:
+
+    class Level
+    {
+    public:
+
+        size2_t size;
+        u32 tiles_x, tiles_y;
+        std::vector<u64> offsets;                       // the range of each tile in file, `tiles + 1` elements
+        std::unique_ptr<TileCache::Entry[]> entries;    // the slots of tiles in cache
+
+        Level(size2_t size_)
+        : size{size_}, tiles_x{(size_.x + tile_size - 1) / tile_size}, tiles_y{(size_.y + tile_size - 1) / tile_size},
+          offsets{}, entries{new TileCache::Entry[u64(tiles_x) * tiles_y]}
+        {
+            for (u64 k = 0; k < u64(tiles_x) * tiles_y; k++) { entries[k].store(0, std::memory_order_relaxed); }
+        }
+        u64 tiles() const noexcept
+        {
+            return u64(tiles_x) * tiles_y;
+        }
+    };
+
+    std::vector<Level> _levels;
+    CachePtr _cache_p;
+    std::array<f32, 256> _linear;   // 8 bits to linear color
+    std::filesystem::path _path;
+    mutable std::ifstream _file;
+    mutable std::mutex _file_mutex;
+
+
+    static inline u32 _pack(RGB24 c) noexcept
+    {
+        return u32(c.r) | (u32(c.g) << 8) | (u32(c.b) << 16);
+    }
+    RGB _unpack(u32 texel) const noexcept
+    {
+        return RGB(_linear[texel & 0xFF], _linear[(texel >> 8) & 0xFF], _linear[(texel >> 16) & 0xFF]);
+    }
+
+    // encode one tile by QOI at the end of `file`
+    static void _encode(std::ofstream & file, Level & level, RGB24 const* texels)
+    {
+        GraphicsBuffer tile{size2_t(tile_size)};
+        for (u32 k = 0; k < TileCache::tile_texels; k++) { tile[u64(k)] = RGB24_to_RGB(texels[k]); }
+        image_formats::QOI().write(file, tile);
+        level.offsets.push_back(file.tellp());
+    }
+    // read one encoded tile from `file`
+    static bool _read(std::istream & file, Level const& level, u64 tile, std::string & encoded)
+    {
+        encoded.assign(level.offsets[tile + 1] - level.offsets[tile], '\0');
+        file.seekg(level.offsets[tile]);
+        file.read(encoded.data(), encoded.size());
+        return u64(file.gcount()) == encoded.size();
+    }
+    // decode one tile read by `_read`
+    static bool _decode(std::string encoded, RGB24 * texels)
+    {
+        std::istringstream stream(std::move(encoded));
+        image_formats::QOI qoi;
+        size2_t size;
+        return qoi.read_header(stream, size) && qoi.read_pixels(stream, texels, texels + TileCache::tile_texels);
+    }
+
+    // the next level of mip pyramid from the last one, each texel is the average of 2x2 texels in linear color
+    bool _build_level(std::ofstream & out, std::ifstream & in, bool gamma)
+    {
+        Level & source = _levels.back();
+        Level level(glm::max(source.size / 2u, size2_t(1)));
+        level.offsets.push_back(out.tellp());
+
+        std::vector<RGB24> block(4 * TileCache::tile_texels), texels(TileCache::tile_texels);
+        std::string encoded;
+        for (u32 j = 0; j < level.tiles_y; j++) for (u32 i = 0; i < level.tiles_x; i++)
+        {
+            // the 2x2 tiles of source, which exist
+            for (u32 b = 0; b < 4; b++)
+            {
+                u32 const si = std::min(2 * i + (b & 1), source.tiles_x - 1), sj = std::min(2 * j + (b >> 1), source.tiles_y - 1);
+                if (!_read(in, source, si + u64(sj) * source.tiles_x, encoded)) { return false; }
+                if (!_decode(std::move(encoded), block.data() + b * TileCache::tile_texels)) { return false; }
+            }
+            auto source_texel = [&] (u32 x, u32 y) -> RGB
+            {
+                x = std::min(x, source.size.x - 1) - 2 * i * tile_size; y = std::min(y, source.size.y - 1) - 2 * j * tile_size;
+                u32 const b = (x / tile_size) + 2 * (y / tile_size);
+                RGB24 const c = block[b * TileCache::tile_texels + (x % tile_size) + (y % tile_size) * tile_size];
+                return RGB(_linear[c.r], _linear[c.g], _linear[c.b]);
+            };
+
+            for (u32 y = 0; y < tile_size; y++) for (u32 x = 0; x < tile_size; x++)
+            {
+                // padded by clamping to edge
+                u32 const gx = std::min(i * tile_size + x, level.size.x - 1), gy = std::min(j * tile_size + y, level.size.y - 1);
+                RGB color = 0.25f * (source_texel(2 * gx, 2 * gy) + source_texel(2 * gx + 1, 2 * gy) + source_texel(2 * gx, 2 * gy + 1) + source_texel(2 * gx + 1, 2 * gy + 1));
+                if (gamma) { color = apply_gamma(color); }
+                texels[x + y * tile_size] = RGB_to_RGB24(color);
+            }
+            _encode(out, level, texels.data());
+        }
+        _levels.push_back(std::move(level));
+        return true;
+    }
+
+    // decode the tile into cache, the texels are also returned for the caller missed.
+    // only reading the file is locked, so that the threads missed decode their tiles at the same time
+    u32 const* _load_tile(Level const& level, u64 tile) const noexcept
+    {
+        thread_local std::vector<RGB24> texels(TileCache::tile_texels);
+        thread_local std::vector<u32> packed(TileCache::tile_texels);
+        std::string encoded;
+        bool read;
+        {
+            std::lock_guard<std::mutex> lock(_file_mutex);
+            read = _read(_file, level, tile, encoded);
+            _file.clear();
+        }
+        bool const decoded = read && _decode(std::move(encoded), texels.data());
+        if (!decoded) { std::fill(packed.begin(), packed.end(), 0); return packed.data(); }
+
+        for (u32 k = 0; k < TileCache::tile_texels; k++) { packed[k] = _pack(texels[k]); }
+        _cache_p->insert(level.entries[tile], packed.data());
+        return packed.data();
+    }
+
+    void _clear() noexcept
+    {
+        for (Level & level : _levels) { _cache_p->release(level.entries.get(), level.entries.get() + level.tiles()); }
+        _levels.clear();
+        if (_file.is_open()) { _file.close(); }
+        if (!_path.empty()) { std::error_code error; std::filesystem::remove(_path, error); _path.clear(); }
+    }
+
+public:
+
+    explicit TiledImage(CachePtr cache_p = TileCache::shared()) noexcept
+    : _levels{}, _cache_p{cache_p}, _linear{}, _path{}, _file{}, _file_mutex{} {}
+    ~TiledImage() noexcept
+    {
+        _clear();
+    }
+    TiledImage(TiledImage const&) = delete;
+    TiledImage & operator = (TiledImage const&) = delete;
+
+
+    // decode the image by pieces & write its tiles into a temporary file, with all levels of mip pyramid.
+    // `Loader` should read pixels by pieces like `image_formats::QOI`
+    /// @param remove_gamma the colors are converted to linear when decoded
+    template<class Loader> bool load(std::filesystem::path path, bool remove_gamma = true)
+    {
+        _clear();
+        for (u32 k = 0; k < 256; k++) { _linear[k] = remove_gamma ? ::nyasRT::remove_gamma(k / 255.0f) : k / 255.0f; }
+
+        std::ifstream source(path, std::ios::in | std::ios::binary);
+        if (!source.is_open()) { return false; }
+        Loader loader;
+        size2_t size;
+        if (!loader.read_header(source, size) || (size.x == 0) || (size.y == 0)) { return false; }
+
+        _path = std::filesystem::temp_directory_path() / ("nyasRT_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+            + "_" + std::to_string(reinterpret_cast<std::uintptr_t>(this)) + ".tiles");
+        std::ofstream out(_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) { _path.clear(); return false; }
+
+        // level 0 by bands of `tile_size` rows, so that only a band is resident
+        Level level(size);
+        level.offsets.push_back(out.tellp());
+        std::vector<RGB24> band(u64(size.x) * tile_size), texels(TileCache::tile_texels);
+        for (u32 j = 0; j < level.tiles_y; j++)
+        {
+            u32 const rows = std::min(tile_size, size.y - j * tile_size);
+            if (!loader.read_pixels(source, band.data(), band.data() + u64(size.x) * rows)) { out.close(); _clear(); return false; }
+            for (u32 i = 0; i < level.tiles_x; i++)
+            {
+                for (u32 y = 0; y < tile_size; y++) for (u32 x = 0; x < tile_size; x++)
+                {
+                    u32 const gx = std::min(i * tile_size + x, size.x - 1), gy = std::min(y, rows - 1);
+                    texels[x + y * tile_size] = band[gx + u64(gy) * size.x];
+                }
+                _encode(out, level, texels.data());
+            }
+        }
+        _levels.push_back(std::move(level));
+
+        while ((_levels.back().size.x > 1) || (_levels.back().size.y > 1))
+        {
+            out.flush();
+            std::ifstream in(_path, std::ios::in | std::ios::binary);
+            if (!(in.is_open() && _build_level(out, in, remove_gamma))) { out.close(); _clear(); return false; }
+        }
+        out.close();
+
+        _file.open(_path, std::ios::in | std::ios::binary);
+        if (!_file.is_open()) { _clear(); return false; }
+        return true;
+    }
+
+
+    u32 levels() const noexcept
+    {
+        return _levels.size();
+    }
+    size2_t size(u32 level = 0) const noexcept
+    {
+        return _levels[level].size;
+    }
+    u64 total(u32 level = 0) const noexcept
+    {
+        return u64(_levels[level].size.x) * _levels[level].size.y;
+    }
+    TileCache const& cache() const noexcept
+    {
+        return *_cache_p;
+    }
+
+    RGB texel(u32 level, index2_t index) const noexcept
+    {
+        Level const& l = _levels[level];
+        u64 const tile = (index.x / tile_size) + u64(index.y / tile_size) * l.tiles_x;
+        u32 const k = (index.x % tile_size) + (index.y % tile_size) * tile_size;
+
+        u32 packed;
+        if (!_cache_p->fetch(l.entries[tile], k, packed)) { packed = _load_tile(l, tile)[k]; }
+        return _unpack(packed);
+    }
+};
+
+} // namespace nyasRT
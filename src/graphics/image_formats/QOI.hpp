@@ -1,5 +1,7 @@
 #pragma once
 
+#include <type_traits>
+
 #include "Formatter.hpp"
 
 
@@ -43,15 +45,23 @@ private:
     }
 
 
+    template<class Pixel> static inline Pixel to_pixel(RGB24 c) noexcept
+    {
+        if constexpr (std::is_same_v<Pixel, RGB>) { return RGB24_to_RGB(c); }
+        else { return c; }
+    }
+
+
     u8 header[14];
     u8 index;
     RGB24 running[64];
     RGB24 prev, curr;
+    u8 alpha, run;  // the state of decoding, a run may be continued by the next `read_pixels`
 
 public:
 
     QOI() noexcept
-    : header{}, index{0}, running{}, prev{}, curr{} {
+    : header{}, index{0}, running{}, prev{}, curr{}, alpha{255}, run{0} {
         // initialize header
         header[0] = 'q'; header[1] = 'o'; header[2] = 'i'; header[3] = 'f';
         header[12] = 3; header[13] = 0;
@@ -148,6 +158,30 @@ public:
     }
 
     virtual bool read(std::istream & file, GraphicsBuffer & gbuf) override
+    {
+        size2_t fig_size;
+        if (!read_header(file, fig_size)) { return false; }
+        if (fig_size != gbuf.size()) { gbuf = GraphicsBuffer(fig_size); }
+        return read_pixels(file, gbuf.begin(), gbuf.end());
+    }
+
+    // read the header only, then the pixels can be read in order by pieces through `read_pixels`,
+    // so that large images are not necessary to be resident
+    bool read_header(std::istream & file, size2_t & fig_size)
+    {
+        file.read(reinterpret_cast<char *>(header), 14);
+        if (file.gcount() != 14) { return false; }
+        fig_size.x = std::byteswap(*reinterpret_cast<u32 *>(header + 4));
+        fig_size.y = std::byteswap(*reinterpret_cast<u32 *>(header + 8));
+
+        prev = RGB24(0, 0, 0);
+        alpha = (header[12] == 3) ? 255 : 0;
+        run = 0;
+        return true;
+    }
+
+    // read the next `end - pix` pixels, `Pixel` can be `RGB` or `RGB24`
+    template<class Pixel> bool read_pixels(std::istream & file, Pixel * pix, Pixel * end)
     {
         auto read = [&] (void * data, u64 length) -> bool
         {
@@ -155,17 +189,7 @@ public:
             return file.gcount() == length;
         };
 
-        size2_t fig_size;
-        if (!read(header, 14)) { return false; }
-        fig_size.x = std::byteswap(*reinterpret_cast<u32 *>(header + 4));
-        fig_size.y = std::byteswap(*reinterpret_cast<u32 *>(header + 8));
-        if (fig_size != gbuf.size()) { gbuf = GraphicsBuffer(fig_size); }
-
-        RGB * pix = gbuf.begin();
-        RGB * end = gbuf.end();
-
-        prev = RGB24(0, 0, 0);
-        u8 alpha = (header[12] == 3) ? 255 : 0;
+        for (; (run > 0) && (pix < end); run--) { *(pix++) = to_pixel<Pixel>(prev); }
 
         u8 encoded, flag, data;
         while (pix < end)
@@ -206,16 +230,13 @@ public:
                 }
                 else                        // -> QOI_OP_RUN
                 {
-                    RGB prev_color = RGB24_to_RGB(prev);
-                    while ((data--) > 0)
-                    {
-                        *(pix++) = prev_color;
-                        if (!(pix < end)) { return true; }
-                    }
+                    // `data + 1` pixels of previous color, the rest are left to the next call
+                    for (run = data + 1; (run > 0) && (pix < end); run--) { *(pix++) = to_pixel<Pixel>(prev); }
+                    continue;
                 }
             }
 
-            *(pix++) = RGB24_to_RGB(curr);
+            *(pix++) = to_pixel<Pixel>(curr);
             index = running_index(curr, alpha);
             prev = running[index] = curr;
         }
@@ -3,12 +3,16 @@
 #include "../third-party/glm/glm.hpp"
 
 #include "common.hpp"
+#include "MappedFile.hpp"
 #include "geometry/Ray.hpp"
 #include "geometry/BoundingBox.hpp"
+#include "geometry/WideBoundingBox.hpp"
+#include "geometry/WideTriangle.hpp"
 #include "geometry/Transform.hpp"
 #include "graphics/GraphicsBuffer.hpp"
 #include "graphics/DisplayWindow.hpp"
 #include "graphics/Interpolation.hpp"
+#include "graphics/TiledImage.hpp"
 #include "graphics/post_process.hpp"
 #include "graphics/image_formats/Formatter.hpp"
 #include "graphics/image_formats/QOI.hpp"
@@ -28,6 +32,8 @@
 #include "components/sky_models/Sky.hpp"
 #include "components/sky_models/GradientSky.hpp"
 #include "components/sky_models/Hosek.hpp"
+#include "components/StaticDispatch.hpp"
 #include "components/Object3D.hpp"
+#include "components/Instance.hpp"
 #include "Scence.hpp"
 #include "Renderer.hpp"